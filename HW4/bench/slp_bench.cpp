@@ -0,0 +1,55 @@
+#include <chrono>
+#include <iostream>
+#include "../src/VectorOptimizer.h"
+
+// Times -vectorize on one long block, a fully unrolled c[i] = a[i] * b[i] + a[i]
+// usage: bench/slp_bench [instructions...]
+std::shared_ptr<ProgramCFG> kernel(unsigned long instructions) {
+   // 5 instructions per element
+   unsigned long n = instructions / 5;
+   std::shared_ptr<BasicBlock> block = std::make_shared<BasicBlock>("main");
+   std::vector<std::string> variables;
+   std::map<std::string, std::string> var_to_type;
+   for (const auto & arr : { "%a", "%b", "%c" }) {
+      block->appendPrimitive(std::make_shared<AllocPrimitive>(arr, std::to_string(n)));
+      variables.push_back(toName(arr));
+      var_to_type[arr] = "ARRAY";
+   }
+   for (unsigned long i=0; i<n; i++) {
+      std::string k = std::to_string(i);
+      block->appendPrimitive(std::make_shared<GetEltPrimitive>("%x" + k, "%a", k));
+      block->appendPrimitive(std::make_shared<GetEltPrimitive>("%y" + k, "%b", k));
+      block->appendPrimitive(std::make_shared<ArithmeticPrimitive>("%z" + k, "%x" + k, '*', "%y" + k));
+      block->appendPrimitive(std::make_shared<ArithmeticPrimitive>("%w" + k, "%z" + k, '+', "%x" + k));
+      block->appendPrimitive(std::make_shared<SetEltPrimitive>("%c", k, "%w" + k));
+   }
+   block->setControl(std::make_shared<RetControl>("0"));
+   return std::make_shared<ProgramCFG>(std::make_shared<MethodCFG>(block, variables, var_to_type));
+}
+
+int main(int argc, char ** argv) {
+   std::vector<unsigned long> sizes = { 1000, 10000, 100000 };
+   if (argc > 1) {
+      sizes.clear();
+      for (int i=1; i<argc; i++) {
+         sizes.push_back(std::stoul(argv[i]));
+      }
+   }
+   std::cout << "instructions\tvector ops\tseconds" << std::endl;
+   for (const auto & size : sizes) {
+      std::shared_ptr<ProgramCFG> p = kernel(size);
+      VectorOptimizer vector_optimizer;
+      auto start = std::chrono::steady_clock::now();
+      p = vector_optimizer.optimize(p);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      // Every vecadd and vecmul is a pack of UNROLL_SIZE scalar ops
+      unsigned long vector_ops = 0;
+      for (const auto & s : p->main_method()->first_block()->primitives()) {
+         if (dynamic_cast<AddVectorPrimitive*>(s.get()) != nullptr || dynamic_cast<MultiplyVectorPrimitive*>(s.get()) != nullptr) {
+            vector_ops++;
+         }
+      }
+      std::cout << size << "\t" << vector_ops << "\t" << elapsed.count() << std::endl;
+   }
+   return 0;
+}
@@ -521,10 +521,13 @@ class ClassDeclaration : public ASTNode
    private:
       std::string _name;
       std::map<std::string, std::string> _fields;
+      // Field names in the order they were declared
+      std::vector<std::string> _field_order;
       std::map<std::string, std::shared_ptr<MethodDeclaration>> _methods;
    public:
-      ClassDeclaration(std::string name, std::map<std::string, std::string> fields, std::map<std::string, std::shared_ptr<MethodDeclaration>> methods):
-         _name(name), _fields(fields), _methods(methods) {}
+      ClassDeclaration(std::string name, std::map<std::string, std::string> fields, std::vector<std::string> field_order,
+            std::map<std::string, std::shared_ptr<MethodDeclaration>> methods):
+         _name(name), _fields(fields), _field_order(field_order), _methods(methods) {}
       std::string toString() override {
          std::string out = std::string("{\"type\":\"ClassDeclaration\",\"name\":\"") +
             _name + std::string("\",\"fields\":[");
@@ -553,6 +556,7 @@ class ClassDeclaration : public ASTNode
       }
       std::string name() { return _name; }
       std::map<std::string, std::string> fields() { return _fields; }
+      std::vector<std::string> field_order() { return _field_order; }
       std::map<std::string, std::shared_ptr<MethodDeclaration>> methods() { return _methods; }
 };
 
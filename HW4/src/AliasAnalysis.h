@@ -0,0 +1,299 @@
+#ifndef _CS_441_ALIAS_ANALYSIS_H
+#define _CS_441_ALIAS_ANALYSIS_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFG.h"
+#include "CFGBuilder.h"
+#include "DominatorSolver.h"
+
+// Type and field based alias analysis
+// Memory is only ever reached through a typed register (an object,
+// its vtable, or its bitfield), and there is no inheritance, so two
+// accesses can only overlap if their bases have the same type and
+// they use the same slot. A call is resolved statically from the
+// receiver type and vtable slot, and only clobbers the fields its
+// callee (or anything it calls) may write.
+class AliasAnalysis
+{
+   private:
+      std::map<std::string, std::vector<std::string>> _vtables;
+      // Class to the slots of its fields that hold objects
+      std::map<std::string, std::set<std::string>> _pointer_slots;
+      // Method to the (type, slot) pairs it may write, "?" for any slot
+      std::map<std::string, std::set<std::pair<std::string, std::string>>> _writes;
+      // Methods that may write memory we can't type
+      std::set<std::string> _writes_unknown;
+      std::map<std::string, std::string> _var_to_type;
+      std::map<std::string, std::shared_ptr<PrimitiveStatement>> _defs;
+      // Registers whose object may be seen by someone else
+      std::set<std::string> _escaped;
+      std::set<std::string> _params;
+      std::string slotOf(std::string index) {
+         return isNumber(index) ? index : "?";
+      }
+      // Collect the writes a method does itself, and the methods it calls
+      std::set<std::string> directWrites(std::shared_ptr<MethodCFG> m, std::string name) {
+         setMethod(m);
+         std::set<std::string> callees;
+         DominatorSolver ds;
+         for (const auto & kv : ds.solveBlockmap(m)) {
+            for (const auto & p : kv.second->primitives()) {
+               std::string base;
+               std::string index = "0";
+               SetEltPrimitive * setelt = dynamic_cast<SetEltPrimitive*>(p.get());
+               SetEltVectorPrimitive * vecsetelt = dynamic_cast<SetEltVectorPrimitive*>(p.get());
+               StorePrimitive * store = dynamic_cast<StorePrimitive*>(p.get());
+               CallPrimitive * call = dynamic_cast<CallPrimitive*>(p.get());
+               if (setelt != nullptr) {
+                  base = setelt->arr();
+                  index = setelt->index();
+               } else if (vecsetelt != nullptr) {
+                  // Several slots, any of them as far as we care
+                  base = vecsetelt->arr();
+                  index = "?";
+               } else if (store != nullptr) {
+                  base = store->addr();
+               } else if (call != nullptr) {
+                  std::string c = callee(call);
+                  if (c == "") {
+                     _writes_unknown.insert(name);
+                  } else {
+                     callees.insert(c);
+                  }
+                  continue;
+               } else {
+                  continue;
+               }
+               if (isFresh(base)) {
+                  // Initializing an object allocated here can't clobber anything older
+                  continue;
+               }
+               std::string type = typeOf(base);
+               if (type == "") {
+                  _writes_unknown.insert(name);
+               } else {
+                  _writes[name].insert(std::make_pair(type, slotOf(index)));
+               }
+            }
+         }
+         return callees;
+      }
+   public:
+      // Primitives that read or write memory
+      static bool touchesMemory(std::shared_ptr<PrimitiveStatement> p) {
+         return dynamic_cast<GetEltPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<SetEltPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<GetEltVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<SetEltVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<LoadPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<StorePrimitive*>(p.get()) != nullptr
+            || dynamic_cast<CallPrimitive*>(p.get()) != nullptr;
+      }
+      void setMethod(std::shared_ptr<MethodCFG> m) {
+         _var_to_type = m->var_to_type();
+         _defs.clear();
+         _escaped.clear();
+         std::vector<std::string> params = m->first_block()->params();
+         _params = std::set<std::string>(params.begin(), params.end());
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(m);
+         for (const auto & kv : blockmap) {
+            for (const auto & p : kv.second->primitives()) {
+               for (const auto & l : p->LHS()) {
+                  _defs[l] = p;
+               }
+            }
+         }
+         // Anything but a base address, a branch, or making the bitfield
+         // pointer lets the object escape
+         for (const auto & kv : blockmap) {
+            for (const auto & p : kv.second->primitives()) {
+               GetEltPrimitive * getelt = dynamic_cast<GetEltPrimitive*>(p.get());
+               SetEltPrimitive * setelt = dynamic_cast<SetEltPrimitive*>(p.get());
+               GetEltVectorPrimitive * vecgetelt = dynamic_cast<GetEltVectorPrimitive*>(p.get());
+               SetEltVectorPrimitive * vecsetelt = dynamic_cast<SetEltVectorPrimitive*>(p.get());
+               LoadPrimitive * load = dynamic_cast<LoadPrimitive*>(p.get());
+               StorePrimitive * store = dynamic_cast<StorePrimitive*>(p.get());
+               PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+               std::vector<std::string> lhs = p->LHS();
+               bool bitfield = lhs.size() == 1 && isFresh(lhs[0]) && allocOf(lhs[0]) != lhs[0];
+               if (getelt != nullptr) {
+                  _escaped.insert(getelt->index());
+               } else if (setelt != nullptr) {
+                  _escaped.insert(setelt->index());
+                  _escaped.insert(setelt->val());
+               } else if (vecgetelt != nullptr) {
+                  _escaped.insert(vecgetelt->index());
+               } else if (vecsetelt != nullptr) {
+                  _escaped.insert(vecsetelt->index());
+                  _escaped.insert(vecsetelt->val());
+               } else if (store != nullptr) {
+                  _escaped.insert(store->val());
+               } else if (phi != nullptr) {
+                  for (const auto & arg : phi->args()) {
+                     _escaped.insert(arg.second);
+                  }
+               } else if (load == nullptr && !bitfield) {
+                  std::vector<std::string> rhs = p->RHS();
+                  _escaped.insert(rhs.begin(), rhs.end());
+               }
+            }
+            if (dynamic_cast<IfElseControl*>(kv.second->control().get()) == nullptr) {
+               std::vector<std::string> rhs = kv.second->control()->RHS();
+               _escaped.insert(rhs.begin(), rhs.end());
+            }
+         }
+      }
+      std::string typeOf(std::string reg) {
+         if (!isRegister(reg) || _var_to_type.find(reg) == _var_to_type.end()) {
+            return "";
+         }
+         return _var_to_type[reg];
+      }
+      // Alloc a register points into (the object or its bitfield), or empty
+      std::string allocOf(std::string reg) {
+         std::shared_ptr<PrimitiveStatement> def = _defs[reg];
+         if (dynamic_cast<AllocPrimitive*>(def.get()) != nullptr) {
+            return reg;
+         }
+         // Its bitfield, slot -1
+         ArithmeticPrimitive * a = dynamic_cast<ArithmeticPrimitive*>(def.get());
+         if (a != nullptr && a->op() == '-' && dynamic_cast<AllocPrimitive*>(_defs[a->op1()].get()) != nullptr) {
+            return a->op1();
+         }
+         return "";
+      }
+      // Register holds an object allocated in this method
+      bool isFresh(std::string reg) {
+         return allocOf(reg) != "";
+      }
+      // Object allocated in this method that nobody else can see
+      bool isLocal(std::string reg) {
+         std::string alloc = allocOf(reg);
+         return alloc != "" && _escaped.find(alloc) == _escaped.end();
+      }
+      // Slot of base may hold an object the GC will follow
+      bool isPointerSlot(std::string base, std::string index) {
+         std::string type = typeOf(base);
+         if (type == VTBL || type == BITFIELD || type == INT || type == METHOD || isConstant(base)) {
+            return false;
+         }
+         if (_pointer_slots.find(type) == _pointer_slots.end() || !isNumber(index)) {
+            return true;
+         }
+         return _pointer_slots[type].find(index) != _pointer_slots[type].end();
+      }
+      // Class whose vtable global this is, or empty
+      std::string vtableClass(std::string base) {
+         for (const auto & kv : _vtables) {
+            if (base == toGlobal(toVtable(kv.first))) {
+               return kv.first;
+            }
+         }
+         return "";
+      }
+      // Vtables are global data that is never written
+      bool isConstant(std::string base) {
+         return typeOf(base) == VTBL || vtableClass(base) != "";
+      }
+      // Accesses to slot index1 of base1 and index2 of base2 may overlap
+      bool mayAlias(std::string base1, std::string index1, std::string base2, std::string index2) {
+         bool same_slot = index1 == index2 || !isNumber(index1) || !isNumber(index2);
+         if (isConstant(base1) || isConstant(base2)) {
+            return false;
+         }
+         if (base1 == base2) {
+            return same_slot;
+         }
+         // Each alloc in SSA form is a different object, one that never
+         // escapes can't be in any other register, and parameters were
+         // all set before it existed
+         std::string alloc1 = allocOf(base1);
+         std::string alloc2 = allocOf(base2);
+         if (alloc1 != alloc2 && ((alloc1 != "" && alloc2 != "") || isLocal(base1) || isLocal(base2))) {
+            return false;
+         }
+         if ((alloc1 != "" && _params.count(base2)) || (alloc2 != "" && _params.count(base1))) {
+            return false;
+         }
+         std::string type1 = typeOf(base1);
+         std::string type2 = typeOf(base2);
+         if (type1 == "" || type2 == "") {
+            return true;
+         }
+         return type1 == type2 && same_slot;
+      }
+      // Method label a call always reaches, or empty if unknown
+      std::string callee(CallPrimitive * call) {
+         GetEltPrimitive * method = dynamic_cast<GetEltPrimitive*>(_defs[call->codeaddr()].get());
+         if (method == nullptr || !isNumber(method->index())) {
+            return "";
+         }
+         // Value numbering may have already folded the vtable load
+         LoadPrimitive * vtable = dynamic_cast<LoadPrimitive*>(_defs[method->arr()].get());
+         std::string type = vtable != nullptr ? typeOf(vtable->addr()) : vtableClass(method->arr());
+         unsigned long index = std::stoul(method->index());
+         if (_vtables.find(type) == _vtables.end() || index >= _vtables[type].size() || _vtables[type][index] == "0") {
+            return "";
+         }
+         return _vtables[type][index];
+      }
+      // Call may write slot index of base
+      bool callMayWrite(CallPrimitive * call, std::string base, std::string index) {
+         if (isConstant(base)) {
+            return false;
+         }
+         std::string c = callee(call);
+         std::string type = typeOf(base);
+         if (c == "" || _writes_unknown.find(c) != _writes_unknown.end() || type == "") {
+            return true;
+         }
+         for (const auto & w : _writes[c]) {
+            if (w.first == type && (w.second == slotOf(index) || w.second == "?" || !isNumber(index))) {
+               return true;
+            }
+         }
+         return false;
+      }
+      // Summarize the writes of every method, including through calls
+      void analyze(ProgramCFG & p) {
+         _vtables.clear();
+         _writes.clear();
+         _writes_unknown.clear();
+         _pointer_slots.clear();
+         for (const auto & kv : p.classes()) {
+            _vtables[kv.first] = kv.second->vtable();
+            std::map<std::string, std::string> field_to_type = kv.second->field_to_type();
+            for (const auto & f : kv.second->field_table()) {
+               if (field_to_type[f.first] != INT) {
+                  _pointer_slots[kv.first].insert(std::to_string(f.second));
+               }
+            }
+         }
+         std::map<std::string, std::set<std::string>> callees;
+         for (const auto & kv : p.classes()) {
+            for (const auto & m : kv.second->methods()) {
+               std::string name = m->first_block()->label();
+               callees[name] = directWrites(m, name);
+            }
+         }
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            for (const auto & kv : callees) {
+               for (const auto & c : kv.second) {
+                  unsigned long size = _writes[kv.first].size();
+                  _writes[kv.first].insert(_writes[c].begin(), _writes[c].end());
+                  bool unknown = _writes_unknown.find(c) != _writes_unknown.end();
+                  if (_writes[kv.first].size() != size || (unknown && _writes_unknown.insert(kv.first).second)) {
+                     changed = true;
+                  }
+               }
+            }
+         }
+      }
+};
+
+#endif
@@ -3,6 +3,8 @@
 #include <map>
 #include "CFG.h"
 #include "IdentityOptimizer.h"
+#include "RewriteRules.h"
+#include "RuleTable.h"
 
 class ArithmeticOptimizer : public IdentityOptimizer
 {
@@ -19,9 +21,14 @@ class ArithmeticOptimizer : public IdentityOptimizer
             _new_block->appendPrimitive(ps);
          }
       }
+      // Rules over several operations, and what defines each register
+      // so far in the method for them to look through (needs SSA)
+      RuleTable _rules;
+      RuleTable::Defs _defs;
    protected:
       std::map<std::string, std::string> _temp_to_const;
    public:
+      ArithmeticOptimizer(RuleTable rules = RuleTable()) : _rules(rules) {}
       // Comment doesn't need adjustment
       void visit(AssignmentPrimitive& node) {
          std::string lhs = node.lhs();
@@ -34,37 +41,23 @@ class ArithmeticOptimizer : public IdentityOptimizer
          std::string op2 = adjustTemp(node.op2());
          std::string lhs = node.lhs();
          char op = node.op();
-         if (isNumber(op1) && isNumber(op2)) {
-            // We can directly update the value
-            std::string newval;
-            unsigned int newval_num;
-            unsigned int op1_num = std::stoul(op1);
-            unsigned int op2_num = std::stoul(op2);
-            if (op == '+') {
-               newval_num = op1_num + op2_num;
-            } else if (op == '-') {
-               newval_num = op1_num - op2_num;
-            } else if (op == '*') {
-               newval_num = op1_num * op2_num;
-            } else if (op == '/') {
-               newval_num = op1_num / op2_num;
-            } else if (op == '&') {
-               newval_num = op1_num & op2_num;
-            } else if (op == '|') {
-               newval_num = op1_num | op2_num;
-            } else {
-               // Assume xor
-               newval_num = op1_num ^ op2_num;
-            }
-            newval = std::to_string(newval_num);
-            appendPrimitive(lhs, newval, std::make_shared<AssignmentPrimitive>(lhs, newval));
+         // Fold constants and simplify identities, same as value numbering
+         RewriteRules::Result simple = RewriteRules::simplify(op, op1, op2);
+         if (simple.op != '=' && _rules.apply(simple.op, simple.op1, simple.op2, _defs, simple) && simple.op != '=') {
+            simple = RewriteRules::simplify(simple.op, simple.op1, simple.op2);
+         }
+         if (simple.op != '=') {
+            _defs[lhs] = std::make_tuple(simple.op, simple.op1, simple.op2);
+         }
+         if (simple.op == '=') {
+            appendPrimitive(lhs, simple.op1, std::make_shared<AssignmentPrimitive>(lhs, simple.op1));
          } else {
             // Append block with adjusted ops
             _new_block->appendPrimitive(std::make_shared<ArithmeticPrimitive>(
                   lhs,
-                  op1,
-                  op,
-                  op2));
+                  simple.op1,
+                  simple.op,
+                  simple.op2));
          }
       }
       void visit(CallPrimitive& node) {
@@ -146,6 +139,18 @@ class ArithmeticOptimizer : public IdentityOptimizer
       void visit(DivideVectorPrimitive& node) {
          _new_block->appendPrimitive(std::make_shared<DivideVectorPrimitive>(adjustTemp(node.lhs()), adjustTemp(node.op1()), adjustTemp(node.op2())));
       }
+      void visit(ReduceVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<ReduceVectorPrimitive>(adjustTemp(node.lhs()), node.op(), adjustTemp(node.rhs())));
+      }
+      void visit(GetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<GetEltVectorPrimitive>(adjustTemp(node.lhs()), adjustTemp(node.arr()), adjustTemp(node.index()), node.width()));
+      }
+      void visit(SetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<SetEltVectorPrimitive>(adjustTemp(node.arr()), adjustTemp(node.index()), adjustTemp(node.val())));
+      }
+      void visit(ShuffleVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<ShuffleVectorPrimitive>(adjustTemp(node.lhs()), adjustTemp(node.rhs()), node.indices()));
+      }
       // FailControl doesn't need adjustment
       // JumpControl doesn't need adjustment
       void visit(IfElseControl& node) {
@@ -158,10 +163,20 @@ class ArithmeticOptimizer : public IdentityOptimizer
          std::string val = adjustTemp(node.val());
          _new_block->setControl(std::make_shared<RetControl>(val));
       }
+      void visit(TailCallControl& node) {
+         std::string codeaddr = adjustTemp(node.codeaddr());
+         std::string receiver = adjustTemp(node.receiver());
+         std::vector<std::string> args;
+         for (auto & a : node.args()) {
+            args.push_back(adjustTemp(a));
+         }
+         _new_block->setControl(std::make_shared<TailCallControl>(codeaddr, receiver, args));
+      }
       void visit(MethodCFG& node) {
          // Wipe map on each method
          // Each method has its own map
          _temp_to_const.clear();
+         _defs.clear();
          // Call parent method
          IdentityOptimizer::visit(node);
       }
@@ -93,6 +93,18 @@ class BetterSSAHelper : public CFGVisitor
       void visit(DivideVectorPrimitive& node) {
          updateGlobalsAndBlocks({ node.lhs() }, { node.op1(), node.op2() });
       }
+      void visit(ReduceVectorPrimitive& node) {
+         updateGlobalsAndBlocks({ node.lhs() }, { node.rhs() });
+      }
+      void visit(GetEltVectorPrimitive& node) {
+         updateGlobalsAndBlocks({ node.lhs() }, { node.arr(), node.index() });
+      }
+      void visit(SetEltVectorPrimitive& node) {
+         updateGlobalsAndBlocks({ node.arr(), node.index(), node.val() });
+      }
+      void visit(ShuffleVectorPrimitive& node) {
+         updateGlobalsAndBlocks({ node.lhs() }, { node.rhs() });
+      }
       // No update needed for fail control
       void visit(FailControl& node) {}
       // No update needed for jump control
@@ -103,6 +115,9 @@ class BetterSSAHelper : public CFGVisitor
       void visit(RetControl& node) {
          updateGlobalsAndBlocks({ node.val() });
       }
+      void visit(TailCallControl& node) {
+         updateGlobalsAndBlocks(node.RHS());
+      }
       void visit(BasicBlock& node) {
          // Empty set
          _varkill = std::set<std::string>({});
@@ -229,7 +244,10 @@ class BetterSSAOptimizer : public SSAOptimizer
                newParams.push_back(p);
             }
             block->set_params(newParams);
-            if (_label_to_phi_variables.find(label) != _label_to_phi_variables.end()) {
+            // Nothing is read once a block fails, shared failure blocks
+            // would otherwise merge every variable
+            bool fails = dynamic_cast<FailControl*>(block->control().get()) != nullptr;
+            if (_label_to_phi_variables.find(label) != _label_to_phi_variables.end() && !fails) {
                std::set<std::string> phi_vars = _label_to_phi_variables[label];
                for (auto & v : phi_vars) {
                   std::string reg = v;
@@ -95,7 +95,11 @@ class PrimitiveStatement : public IRStatement
 };
 
 class ControlStatement : public IRStatement
-{};
+{
+   public:
+      virtual std::vector<std::string> RHS() = 0;
+      virtual std::vector<std::string> targets() = 0;
+};
 
 // Forward declare all specific nodes here
 class Comment;
@@ -115,10 +119,15 @@ class AddVectorPrimitive;
 class SubtractVectorPrimitive;
 class MultiplyVectorPrimitive;
 class DivideVectorPrimitive;
+class ReduceVectorPrimitive;
+class GetEltVectorPrimitive;
+class SetEltVectorPrimitive;
+class ShuffleVectorPrimitive;
 class FailControl;
 class JumpControl;
 class IfElseControl;
 class RetControl;
+class TailCallControl;
 class BasicBlock;
 class MethodCFG;
 class ClassCFG;
@@ -145,10 +154,15 @@ class CFGVisitor
       virtual void visit(SubtractVectorPrimitive& node) = 0;
       virtual void visit(MultiplyVectorPrimitive& node) = 0;
       virtual void visit(DivideVectorPrimitive& node) = 0;
+      virtual void visit(ReduceVectorPrimitive& node) = 0;
+      virtual void visit(GetEltVectorPrimitive& node) = 0;
+      virtual void visit(SetEltVectorPrimitive& node) = 0;
+      virtual void visit(ShuffleVectorPrimitive& node) = 0;
       virtual void visit(FailControl& node) = 0;
       virtual void visit(JumpControl& node) = 0;
       virtual void visit(IfElseControl& node) = 0;
       virtual void visit(RetControl& node) = 0;
+      virtual void visit(TailCallControl& node) = 0;
       virtual void visit(BasicBlock& node) = 0;
       virtual void visit(MethodCFG& node) = 0;
       virtual void visit(ClassCFG& node) = 0;
@@ -451,6 +465,7 @@ class StorePrimitive : public PrimitiveStatement
 };
 
 #define VECTOR "VEC"
+// Lanes per vector unless -vecwidth says otherwise
 #define UNROLL_SIZE 4
 
 class LoadVectorPrimitive : public PrimitiveStatement
@@ -619,6 +634,116 @@ class DivideVectorPrimitive : public PrimitiveStatement
       }
 };
 
+// Combines every lane of a vector with op (one of + * & | ^) into a scalar
+class ReduceVectorPrimitive : public PrimitiveStatement
+{
+   private:
+      std::string _lhs;
+      char _op;
+      std::string _rhs;
+   public:
+      ReduceVectorPrimitive(std::string lhs, char op, std::string rhs): _lhs(lhs), _op(op), _rhs(rhs) {}
+      std::string lhs() { return _lhs; }
+      char op() { return _op; }
+      std::string rhs() { return _rhs; }
+      std::string toString() override {
+         return _lhs + " = vecreduce(" + std::string(1, _op) + ", " + _rhs + ")";
+      }
+      void accept(CFGVisitor& v) override {
+         v.visit(*this);
+      }
+      virtual std::vector<std::string> LHS() override {
+         return { _lhs };
+      }
+      virtual std::vector<std::string> RHS() override {
+         return { _rhs };
+      }
+};
+
+// Reads width consecutive slots of arr starting at index into a vector
+class GetEltVectorPrimitive : public PrimitiveStatement
+{
+   private:
+      std::string _lhs;
+      std::string _arr;
+      std::string _index;
+      unsigned long _width;
+   public:
+      GetEltVectorPrimitive(std::string lhs, std::string arr, std::string index, unsigned long width): _lhs(lhs), _arr(arr), _index(index), _width(width) {}
+      std::string lhs() { return _lhs; }
+      std::string arr() { return _arr; }
+      std::string index() { return _index; }
+      unsigned long width() { return _width; }
+      std::string toString() override {
+         return _lhs + " = vecgetelt(" + _arr + ", " + _index + ", " + std::to_string(_width) + ")";
+      }
+      void accept(CFGVisitor& v) override {
+         v.visit(*this);
+      }
+      virtual std::vector<std::string> LHS() override {
+         return { _lhs };
+      }
+      virtual std::vector<std::string> RHS() override {
+         return { _arr, _index };
+      }
+};
+
+// Writes every lane of val to consecutive slots of arr starting at index
+class SetEltVectorPrimitive : public PrimitiveStatement
+{
+   private:
+      std::string _arr;
+      std::string _index;
+      std::string _val;
+   public:
+      SetEltVectorPrimitive(std::string arr, std::string index, std::string val): _arr(arr), _index(index), _val(val) {}
+      std::string arr() { return _arr; }
+      std::string index() { return _index; }
+      std::string val() { return _val; }
+      std::string toString() override {
+         return std::string("vecsetelt(") + _arr + ", " + _index + ", " + _val + ")";
+      }
+      void accept(CFGVisitor& v) override {
+         v.visit(*this);
+      }
+      virtual std::vector<std::string> LHS() override {
+         return {};
+      }
+      virtual std::vector<std::string> RHS() override {
+         return { _arr, _index, _val };
+      }
+};
+
+// Lane i of the result is lane indices[i] of rhs
+class ShuffleVectorPrimitive : public PrimitiveStatement
+{
+   private:
+      std::string _lhs;
+      std::string _rhs;
+      std::vector<unsigned long> _indices;
+   public:
+      ShuffleVectorPrimitive(std::string lhs, std::string rhs, std::vector<unsigned long> indices): _lhs(lhs), _rhs(rhs), _indices(indices) {}
+      std::string lhs() { return _lhs; }
+      std::string rhs() { return _rhs; }
+      std::vector<unsigned long> indices() { return _indices; }
+      std::string toString() override {
+         std::string str = _lhs + " = vecshuffle(" + _rhs;
+         for (const auto & i : _indices) {
+            str += ", " + std::to_string(i);
+         }
+         return str + ")";
+      }
+      void accept(CFGVisitor& v) override {
+         v.visit(*this);
+      }
+      virtual std::vector<std::string> LHS() override {
+         return { _lhs };
+      }
+      virtual std::vector<std::string> RHS() override {
+         return { _rhs };
+      }
+};
+
 #define NOT_A_POINTER "NotAPointer"
 #define NOT_A_NUMBER "NotANumber"
 #define NO_SUCH_FIELD "NoSuchField"
@@ -637,6 +762,12 @@ class FailControl : public ControlStatement
       void accept(CFGVisitor& v) override {
          v.visit(*this);
       }
+      virtual std::vector<std::string> RHS() override {
+         return {};
+      }
+      virtual std::vector<std::string> targets() override {
+         return {};
+      }
 };
 
 class JumpControl : public ControlStatement
@@ -652,6 +783,12 @@ class JumpControl : public ControlStatement
       void accept(CFGVisitor& v) override {
          v.visit(*this);
       }
+      virtual std::vector<std::string> RHS() override {
+         return {};
+      }
+      virtual std::vector<std::string> targets() override {
+         return { _branch };
+      }
 };
 
 class IfElseControl : public ControlStatement
@@ -674,6 +811,12 @@ class IfElseControl : public ControlStatement
       void accept(CFGVisitor& v) override {
          v.visit(*this);
       }
+      virtual std::vector<std::string> RHS() override {
+         return { _cond };
+      }
+      virtual std::vector<std::string> targets() override {
+         return { _if_branch, _else_branch };
+      }
 };
 
 class RetControl : public ControlStatement
@@ -689,6 +832,50 @@ class RetControl : public ControlStatement
       void accept(CFGVisitor& v) override {
          v.visit(*this);
       }
+      virtual std::vector<std::string> RHS() override {
+         return { _val };
+      }
+      virtual std::vector<std::string> targets() override {
+         return {};
+      }
+};
+
+// Call that replaces the current frame, the callee returns
+// straight to our caller
+class TailCallControl : public ControlStatement
+{
+   private:
+      std::string _codeaddr;
+      std::string _receiver;
+      std::vector<std::string> _args;
+   public:
+      TailCallControl(std::string codeaddr, std::string receiver, std::vector<std::string> args):
+         _codeaddr(codeaddr),
+         _receiver(receiver),
+         _args(args) {}
+      std::string codeaddr() { return _codeaddr; }
+      std::string receiver() { return _receiver; }
+      std::vector<std::string> args() { return _args; }
+      std::string toString() override {
+         std::stringstream buf;
+         buf << "tailcall(" << _codeaddr << ", " << _receiver;
+         for (auto & arg : _args) {
+            buf << ", " << arg;
+         }
+         buf << ")";
+         return buf.str();
+      }
+      void accept(CFGVisitor& v) override {
+         v.visit(*this);
+      }
+      virtual std::vector<std::string> RHS() override {
+         std::vector<std::string> rhs = { _codeaddr, _receiver };
+         rhs.insert(rhs.end(), _args.begin(), _args.end());
+         return rhs;
+      }
+      virtual std::vector<std::string> targets() override {
+         return {};
+      }
 };
 
 class BasicBlock
@@ -799,6 +986,14 @@ class MethodCFG
       std::shared_ptr<BasicBlock> _first_block;
       std::vector<std::string> _variables;
       std::map<std::string, std::string> _var_to_type;
+      // Order to emit the blocks in, ownership order if empty
+      std::vector<std::string> _layout;
+      void collect(std::map<std::string, std::shared_ptr<BasicBlock>> & blocks, std::shared_ptr<BasicBlock> block) {
+         blocks[block->label()] = block;
+         for (auto & next : block->children()) {
+            collect(blocks, next);
+         }
+      }
    public:
       MethodCFG(std::shared_ptr<BasicBlock> first_block, std::vector<std::string> variables,
             std::map<std::string, std::string> var_to_type):
@@ -806,8 +1001,18 @@ class MethodCFG
          _variables(variables),
          _var_to_type(var_to_type) {}
       std::string toString() {
-         return _first_block->toStringRecursive();
+         if (_layout.empty()) {
+            return _first_block->toStringRecursive();
+         }
+         std::map<std::string, std::shared_ptr<BasicBlock>> blocks;
+         collect(blocks, _first_block);
+         std::stringstream buf;
+         for (auto & label : _layout) {
+            buf << blocks[label]->toString();
+         }
+         return buf.str();
       }
+      void setLayout(std::vector<std::string> layout) { _layout = layout; }
       void accept(CFGVisitor& v) {
          v.visit(*this);
       }
@@ -876,6 +1081,8 @@ class ProgramCFG
    private:
       std::shared_ptr<MethodCFG> _main_method;
       std::map<std::string, std::shared_ptr<ClassCFG>> _classes;
+      // Global arrays besides the vtables
+      std::map<std::string, std::vector<std::string>> _globals;
    public:
       ProgramCFG(std::shared_ptr<MethodCFG> main_method): _main_method(main_method) {}
       std::string toString() {
@@ -885,6 +1092,18 @@ class ProgramCFG
          for (auto & kv : _classes) {
             buf << kv.second->dataString();
          }
+         for (auto & kv : _globals) {
+            buf << "global array " << kv.first << ": { ";
+            int i = 0;
+            for (auto & v : kv.second) {
+               if (i > 0) {
+                  buf << ", ";
+               }
+               buf << v;
+               i++;
+            }
+            buf << " }\n";
+         }
          // Write code
          buf << "code:\n\n";
          // Write class methods
@@ -899,11 +1118,15 @@ class ProgramCFG
       void appendClass(std::shared_ptr<ClassCFG> c) {
          _classes[c->name()] = c;
       }
+      void appendGlobal(std::string name, std::vector<std::string> values) {
+         _globals[name] = values;
+      }
       void accept(CFGVisitor& v) {
          v.visit(*this);
       }
       std::shared_ptr<MethodCFG> main_method() { return _main_method; }
       std::map<std::string, std::shared_ptr<ClassCFG>> classes() { return _classes; }
+      std::map<std::string, std::vector<std::string>> globals() { return _globals; }
 };
 
 #endif
@@ -115,8 +115,12 @@ void CFGBuilder::visit(NewObjectExpression& node) {
    for (const auto & kv : fields) {
       std::string type = field_to_type[kv.first];
       if (classes.find(type) != classes.end()) {
-         // Pointer type
-         bits |= (1 << kv.second);
+         // Pointer type, the GC can only see the first 64 slots
+         if (kv.second >= 64) {
+            throw CFGBuilderException("Class " + classname + " has pointer field " + kv.first + " at slot "
+                  + std::to_string(kv.second) + ", past the 64 slots the GC bitfield covers");
+         }
+         bits |= ((uint64_t) 1 << kv.second);
       }
       // No-op for non-pointer
    }
@@ -385,6 +389,7 @@ void CFGBuilder::visit(PrintStatement& node) {
 void CFGBuilder::visit(MethodDeclaration& node) {
    // Reset temporary counter
    resetCounter();
+   _failure_blocks.clear();
    std::string methodName = toMethodName(_curr_class->name(), node.name());
    // Build list of parameters and types
    std::vector<std::string> params;
@@ -509,6 +514,9 @@ void CFGBuilder::visit(ProgramDeclaration& node) {
          fieldnames.push_back(fi.first);
          field_to_type[fi.first] = fi.second;
       }
+      if (_field_order.count(node->name())) {
+         fieldnames = _field_order[node->name()];
+      }
       std::map<std::string, unsigned long> fieldsMap;
       int index = 1;
       for (auto & f : fieldnames) {
@@ -524,6 +532,7 @@ void CFGBuilder::visit(ProgramDeclaration& node) {
       cl.second->accept(*this);
    }
    resetCounter();
+   _failure_blocks.clear();
    _curr_block = main_block;
    _curr_method = main_method;
    // Initialize every local to 0
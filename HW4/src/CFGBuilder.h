@@ -42,6 +42,12 @@ class CFGBuilder : public ASTVisitor
       std::shared_ptr<ClassCFG> _curr_class;
       std::shared_ptr<ProgramCFG> _curr_program;
       std::shared_ptr<ProgramDeclaration> _program_ast;
+      // With shared failures, each method has one failure block per
+      // message that every check branches to
+      bool _shared_failures;
+      std::map<std::string, std::shared_ptr<BasicBlock>> _failure_blocks;
+      // Class to its fields in slot order, alphabetical for classes not in it
+      std::map<std::string, std::vector<std::string>> _field_order;
       void resetCounter(std::string name = "") {
          _name_counter[name] = 1;
       }
@@ -54,6 +60,8 @@ class CFGBuilder : public ASTVisitor
       std::string createTemp(std::string type) {
          std::string reg = toRegister(createName());
          _curr_class->setType(reg, type);
+         // Also record per method, temporaries are only unique per method
+         _curr_method->setType(reg, type);
          return reg;
       }
       std::string createLabel() {
@@ -69,23 +77,39 @@ class CFGBuilder : public ASTVisitor
          return ret;
       }
       void nonzeroCheck(std::string reg, std::string failLabel, std::string failMsg) {
-         // Build failure block
-         std::string failureBlockLabel = createName(failLabel);
-         std::shared_ptr<BasicBlock> failureBlock = std::make_shared<BasicBlock>(failureBlockLabel);
-         failureBlock->setControl(std::make_shared<FailControl>(failMsg)); 
+         // Build failure block, or reuse the method's one for the message
+         bool shared = _shared_failures && _failure_blocks.count(failMsg);
+         std::shared_ptr<BasicBlock> failureBlock;
+         if (shared) {
+            failureBlock = _failure_blocks[failMsg];
+         } else {
+            failureBlock = std::make_shared<BasicBlock>(createName(failLabel));
+            failureBlock->setControl(std::make_shared<FailControl>(failMsg)); 
+            if (_shared_failures) {
+               _failure_blocks[failMsg] = failureBlock;
+            }
+         }
+         std::string failureBlockLabel = failureBlock->label();
          // Build success block
          std::string nextBlockLabel = createLabel();
          std::shared_ptr<BasicBlock> successBlock = std::make_shared<BasicBlock>(nextBlockLabel);
          // Curr block owns success block
          addNewChild(_curr_block, successBlock);
-         // Curr block owns failure block
-         addNewChild(_curr_block, failureBlock);
+         // Curr block owns failure block, unless an earlier check does
+         if (shared) {
+            addExistingChild(_curr_block, failureBlock);
+         } else {
+            addNewChild(_curr_block, failureBlock);
+         }
          _curr_block->setControl(std::make_shared<IfElseControl>(reg, nextBlockLabel, failureBlockLabel));
          // Remove current block and replace with success block
          _curr_block = successBlock;
       }
 
    public:
+      CFGBuilder(bool shared_failures = false, std::map<std::string, std::vector<std::string>> field_order = {}):
+         _shared_failures(shared_failures),
+         _field_order(field_order) {}
       void visit(UInt32Literal& node);
       void visit(VariableIdentifier& node);
       void visit(ArithmeticExpression& node); 
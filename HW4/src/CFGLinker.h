@@ -0,0 +1,103 @@
+#ifndef _CS_441_CFG_LINKER_H
+#define _CS_441_CFG_LINKER_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFG.h"
+
+// Helper class for passes that restructure a method (split edges,
+// add or remove blocks). Passes build fresh unlinked blocks, and
+// the linker rebuilds ownership and predecessor links from the
+// control statements so the rest of the pipeline can walk it.
+class CFGLinker
+{
+   private:
+      std::map<std::string, std::shared_ptr<BasicBlock>> _blocks;
+      std::map<std::string, unsigned long> _position;
+      std::set<std::string> _owned;
+      void updateOrder(std::vector<std::string> & order, std::set<std::string> & seen,
+            std::shared_ptr<BasicBlock> block) {
+         if (seen.find(block->label()) != seen.end()) {
+            return;
+         }
+         seen.insert(block->label());
+         order.push_back(block->label());
+         for (const auto & child : block->children()) {
+            updateOrder(order, seen, child);
+         }
+      }
+      void linkChildren(std::shared_ptr<BasicBlock> block) {
+         // Visit successors in preferred emission order
+         std::vector<std::string> targets = block->control()->targets();
+         std::vector<std::string> succs;
+         for (const auto & t : targets) {
+            if (_blocks.find(t) != _blocks.end() && std::find(succs.begin(), succs.end(), t) == succs.end()) {
+               succs.push_back(t);
+            }
+         }
+         std::stable_sort(succs.begin(), succs.end(), [&] (const std::string & a, const std::string & b) {
+            return _position[a] < _position[b];
+         });
+         std::vector<std::shared_ptr<BasicBlock>> owned;
+         for (const auto & s : succs) {
+            std::shared_ptr<BasicBlock> child = _blocks[s];
+            if (_owned.find(s) == _owned.end()) {
+               // First time we reach the block, we own it
+               _owned.insert(s);
+               addNewChild(block, child);
+               owned.push_back(child);
+            } else {
+               addExistingChild(block, child);
+            }
+         }
+         for (auto & child : owned) {
+            linkChildren(child);
+         }
+      }
+   public:
+      // First temporary number not used anywhere in the method
+      static unsigned long nextTemporary(std::map<std::string, std::shared_ptr<BasicBlock>> & blockmap) {
+         unsigned long max = 0;
+         for (const auto & kv : blockmap) {
+            std::vector<std::string> regs = kv.second->params();
+            for (const auto & p : kv.second->primitives()) {
+               std::vector<std::string> lhs = p->LHS();
+               regs.insert(regs.end(), lhs.begin(), lhs.end());
+            }
+            for (const auto & r : regs) {
+               if (isTemporary(r) && r.length() > 1) {
+                  max = std::max(max, std::stoul(toName(r)));
+               }
+            }
+         }
+         return max + 1;
+      }
+      // Emission order of an existing method (ownership preorder)
+      std::vector<std::string> order(std::shared_ptr<MethodCFG> m) {
+         std::vector<std::string> order;
+         std::set<std::string> seen;
+         updateOrder(order, seen, m->first_block());
+         return order;
+      }
+      // Link unlinked blocks into a new method. The first block is the entry,
+      // and the order of the list is the preferred emission order.
+      // Blocks that are not reachable from the entry are dropped.
+      std::shared_ptr<MethodCFG> link(std::vector<std::shared_ptr<BasicBlock>> blocks,
+            std::vector<std::string> variables, std::map<std::string, std::string> var_to_type) {
+         _blocks.clear();
+         _position.clear();
+         _owned.clear();
+         unsigned long i = 0;
+         for (const auto & b : blocks) {
+            _blocks[b->label()] = b;
+            _position[b->label()] = i++;
+         }
+         std::shared_ptr<BasicBlock> entry = blocks[0];
+         _owned.insert(entry->label());
+         linkChildren(entry);
+         return std::make_shared<MethodCFG>(entry, variables, var_to_type);
+      }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef _CS_441_DEAD_STORE_OPTIMIZER_H
+#define _CS_441_DEAD_STORE_OPTIMIZER_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AliasAnalysis.h"
+#include "CFG.h"
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "IdentityOptimizer.h"
+
+// Dead store elimination for setelt and store
+// Backward dataflow over the (base, slot)s that are certainly written
+// again before anything can read them, intersected at branches. A store
+// to one of those is dropped. This is mostly the constructor zeroing
+// every field right before the fields get their real values.
+// Expects value numbered SSA form, so equal bases share a register.
+class DeadStoreOptimizer : public IdentityOptimizer
+{
+   private:
+      typedef std::set<std::pair<std::string, std::string>> Overwritten;
+      AliasAnalysis _aa;
+      std::set<PrimitiveStatement*> _dead;
+      void transfer(Overwritten & over, std::shared_ptr<PrimitiveStatement> p, bool record) {
+         GetEltPrimitive * getelt = dynamic_cast<GetEltPrimitive*>(p.get());
+         SetEltPrimitive * setelt = dynamic_cast<SetEltPrimitive*>(p.get());
+         LoadPrimitive * load = dynamic_cast<LoadPrimitive*>(p.get());
+         StorePrimitive * store = dynamic_cast<StorePrimitive*>(p.get());
+         GetEltVectorPrimitive * vecgetelt = dynamic_cast<GetEltVectorPrimitive*>(p.get());
+         std::pair<std::string, std::string> loc;
+         // load and store are slot 0
+         if (setelt != nullptr || store != nullptr) {
+            loc = setelt != nullptr ? std::make_pair(setelt->arr(), setelt->index()) : std::make_pair(store->addr(), std::string("0"));
+            if (over.find(loc) != over.end()) {
+               if (record) {
+                  _dead.insert(p.get());
+               }
+            } else if (isNumber(loc.second)) {
+               over.insert(loc);
+            }
+            return;
+         }
+         for (auto it = over.begin(); it != over.end(); ) {
+            bool read = false;
+            if (getelt != nullptr) {
+               read = _aa.mayAlias(it->first, it->second, getelt->arr(), getelt->index());
+            } else if (load != nullptr) {
+               read = _aa.mayAlias(it->first, it->second, load->addr(), "0");
+            } else if (vecgetelt != nullptr) {
+               read = _aa.mayAlias(it->first, it->second, vecgetelt->arr(), "?");
+            } else if (dynamic_cast<CallPrimitive*>(p.get()) != nullptr) {
+               // The callee can read anything it can reach, and the GC
+               // follows the pointers of everything
+               read = !_aa.isLocal(it->first) || _aa.isPointerSlot(it->first, it->second);
+            } else if (dynamic_cast<AllocPrimitive*>(p.get()) != nullptr) {
+               read = _aa.isPointerSlot(it->first, it->second);
+            }
+            if (read) {
+               it = over.erase(it);
+            } else {
+               it++;
+            }
+         }
+      }
+   public:
+      void visit(SetEltPrimitive& node) {
+         if (_dead.find(&node) == _dead.end()) {
+            IdentityOptimizer::visit(node);
+         }
+      }
+      void visit(StorePrimitive& node) {
+         if (_dead.find(&node) == _dead.end()) {
+            IdentityOptimizer::visit(node);
+         }
+      }
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         _aa.setMethod(method);
+         _dead.clear();
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         // Every written location, what a block that fails (or hasn't
+         // been solved yet) starts with, since nothing is read after
+         Overwritten all;
+         for (const auto & label : order) {
+            for (const auto & p : blockmap[label]->primitives()) {
+               SetEltPrimitive * setelt = dynamic_cast<SetEltPrimitive*>(p.get());
+               StorePrimitive * store = dynamic_cast<StorePrimitive*>(p.get());
+               if (setelt != nullptr) {
+                  all.insert(std::make_pair(setelt->arr(), setelt->index()));
+               } else if (store != nullptr) {
+                  all.insert(std::make_pair(store->addr(), std::string("0")));
+               }
+            }
+         }
+         std::map<std::string, Overwritten> in;
+         // Overwritten on exit from a block, from its successors
+         auto out = [&] (std::string label) {
+            std::shared_ptr<ControlStatement> control = blockmap[label]->control();
+            if (dynamic_cast<FailControl*>(control.get()) != nullptr) {
+               return all;
+            }
+            if (dynamic_cast<JumpControl*>(control.get()) == nullptr && dynamic_cast<IfElseControl*>(control.get()) == nullptr) {
+               // Returning, the caller may read anything
+               return Overwritten();
+            }
+            Overwritten over = all;
+            for (const auto & t : control->targets()) {
+               if (in.find(t) == in.end()) {
+                  continue;
+               }
+               for (auto it = over.begin(); it != over.end(); ) {
+                  if (in[t].find(*it) == in[t].end()) {
+                     it = over.erase(it);
+                  } else {
+                     it++;
+                  }
+               }
+            }
+            return over;
+         };
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            for (auto label = order.rbegin(); label != order.rend(); label++) {
+               Overwritten over = out(*label);
+               std::vector<std::shared_ptr<PrimitiveStatement>> primitives = blockmap[*label]->primitives();
+               for (auto p = primitives.rbegin(); p != primitives.rend(); p++) {
+                  transfer(over, *p, false);
+               }
+               if (in.find(*label) == in.end() || in[*label] != over) {
+                  in[*label] = over;
+                  changed = true;
+               }
+            }
+         }
+         for (const auto & label : order) {
+            Overwritten over = out(label);
+            std::vector<std::shared_ptr<PrimitiveStatement>> primitives = blockmap[label]->primitives();
+            for (auto p = primitives.rbegin(); p != primitives.rend(); p++) {
+               transfer(over, *p, true);
+            }
+         }
+         IdentityOptimizer::visit(node);
+      }
+      void visit(ProgramCFG& node) {
+         _aa.analyze(node);
+         IdentityOptimizer::visit(node);
+      }
+};
+
+#endif
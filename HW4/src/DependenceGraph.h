@@ -0,0 +1,204 @@
+#ifndef _CS_441_DEPENDENCE_GRAPH_H
+#define _CS_441_DEPENDENCE_GRAPH_H
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AliasAnalysis.h"
+#include "CFG.h"
+
+// Dependences between the primitives of a single block
+// An edge from i to j (always i < j) means j has to stay after i. That
+// is register flow, anti and output dependences, and memory: accesses to
+// the same (base, slot) where one is a write, according to the alias
+// analysis. Calls may read and write anything, and they, allocs (the GC
+// follows pointer fields) and prints keep their order with each other.
+// Edges already implied through others are mostly left out, so this
+// builds in close to linear time on long blocks.
+class DependenceGraph
+{
+   private:
+      std::vector<std::set<unsigned long>> _preds;
+      std::vector<std::set<unsigned long>> _succs;
+      enum Kind { NONE, READ, WRITE, CALL, ALLOC, PRINT };
+      struct Access {
+         Kind kind;
+         std::string base;
+         std::string index;
+      };
+      Access access(std::shared_ptr<PrimitiveStatement> p) {
+         GetEltPrimitive * getelt = dynamic_cast<GetEltPrimitive*>(p.get());
+         SetEltPrimitive * setelt = dynamic_cast<SetEltPrimitive*>(p.get());
+         LoadPrimitive * load = dynamic_cast<LoadPrimitive*>(p.get());
+         StorePrimitive * store = dynamic_cast<StorePrimitive*>(p.get());
+         GetEltVectorPrimitive * vecgetelt = dynamic_cast<GetEltVectorPrimitive*>(p.get());
+         SetEltVectorPrimitive * vecsetelt = dynamic_cast<SetEltVectorPrimitive*>(p.get());
+         // load and store are slot 0, vector accesses span several
+         if (getelt != nullptr) {
+            return { READ, getelt->arr(), getelt->index() };
+         } else if (load != nullptr) {
+            return { READ, load->addr(), "0" };
+         } else if (setelt != nullptr) {
+            return { WRITE, setelt->arr(), setelt->index() };
+         } else if (store != nullptr) {
+            return { WRITE, store->addr(), "0" };
+         } else if (vecgetelt != nullptr) {
+            return { READ, vecgetelt->arr(), "?" };
+         } else if (vecsetelt != nullptr) {
+            return { WRITE, vecsetelt->arr(), "?" };
+         } else if (dynamic_cast<CallPrimitive*>(p.get()) != nullptr) {
+            return { CALL, "", "" };
+         } else if (dynamic_cast<AllocPrimitive*>(p.get()) != nullptr) {
+            return { ALLOC, "", "" };
+         } else if (dynamic_cast<PrintPrimitive*>(p.get()) != nullptr) {
+            return { PRINT, "", "" };
+         }
+         return { NONE, "", "" };
+      }
+      // Barrier b has to stay ordered with the read or write a
+      bool conflicts(Access b, Access a, std::shared_ptr<PrimitiveStatement> pb, AliasAnalysis & aa) {
+         if (b.kind == CALL) {
+            // Reads only care if the callee may write them
+            return a.kind == WRITE || aa.callMayWrite(dynamic_cast<CallPrimitive*>(pb.get()), a.base, a.index);
+         }
+         return b.kind == ALLOC && a.kind == WRITE && aa.isPointerSlot(a.base, a.index);
+      }
+      void addEdge(unsigned long from, unsigned long to) {
+         if (from != to) {
+            _succs[from].insert(to);
+            _preds[to].insert(from);
+         }
+      }
+   public:
+      DependenceGraph(std::vector<std::shared_ptr<PrimitiveStatement>> primitives, AliasAnalysis & aa)
+         : _preds(primitives.size()), _succs(primitives.size()) {
+         std::vector<Access> accesses;
+         for (const auto & p : primitives) {
+            Access a = access(p);
+            // Vtables are never written, so reading them orders nothing
+            if ((a.kind == READ || a.kind == WRITE) && aa.isConstant(a.base)) {
+               a.kind = NONE;
+            }
+            accesses.push_back(a);
+         }
+         // Registers
+         std::map<std::string, unsigned long> last_def;
+         std::map<std::string, std::vector<unsigned long>> uses_since_def;
+         for (unsigned long j=0; j<primitives.size(); j++) {
+            for (const auto & r : primitives[j]->RHS()) {
+               if (last_def.find(r) != last_def.end()) {
+                  addEdge(last_def[r], j);
+               }
+               uses_since_def[r].push_back(j);
+            }
+            for (const auto & l : primitives[j]->LHS()) {
+               // Output and anti, only without SSA
+               if (last_def.find(l) != last_def.end()) {
+                  addEdge(last_def[l], j);
+               }
+               for (const auto & u : uses_since_def[l]) {
+                  addEdge(u, j);
+               }
+               uses_since_def[l].clear();
+               last_def[l] = j;
+            }
+         }
+         // Memory, accesses are bucketed by slot since different slots
+         // never overlap, and ones we can't place go everywhere
+         std::map<std::string, std::vector<unsigned long>> slot_reads;
+         std::map<std::string, std::vector<unsigned long>> slot_writes;
+         std::vector<unsigned long> any_reads;
+         std::vector<unsigned long> any_writes;
+         std::vector<unsigned long> reads;
+         std::vector<unsigned long> writes;
+         // Calls and allocs, and the last of those or a print
+         std::vector<unsigned long> clobbers;
+         long last_barrier = -1;
+         // Since the last call, a call has to come after all of these
+         std::vector<unsigned long> pending_writes;
+         std::vector<unsigned long> pending_reads;
+         for (unsigned long j=0; j<primitives.size(); j++) {
+            Access a = accesses[j];
+            if (a.kind == READ || a.kind == WRITE) {
+               // The latest clobber in the way implies all earlier ones
+               for (auto b = clobbers.rbegin(); b != clobbers.rend(); b++) {
+                  if (conflicts(accesses[*b], a, primitives[*b], aa)) {
+                     addEdge(*b, j);
+                     break;
+                  }
+               }
+               // Without a type the base may point anywhere into an object
+               bool known = isNumber(a.index) && aa.typeOf(a.base) != "";
+               std::vector<std::vector<unsigned long>*> candidates;
+               if (known) {
+                  candidates = { &slot_writes[a.index], &any_writes };
+                  if (a.kind == WRITE) {
+                     candidates.push_back(&slot_reads[a.index]);
+                     candidates.push_back(&any_reads);
+                  }
+               } else {
+                  candidates = { &writes };
+                  if (a.kind == WRITE) {
+                     candidates.push_back(&reads);
+                  }
+               }
+               // Anything before a write to this same base and slot is
+               // already ordered before that write
+               long cutoff = -1;
+               for (auto w = candidates[0]->rbegin(); w != candidates[0]->rend() && a.index != "?"; w++) {
+                  if (accesses[*w].base == a.base && accesses[*w].index == a.index) {
+                     cutoff = *w;
+                     break;
+                  }
+               }
+               for (auto * c : candidates) {
+                  for (auto i = c->rbegin(); i != c->rend() && (long) *i >= cutoff; i++) {
+                     if (aa.mayAlias(accesses[*i].base, accesses[*i].index, a.base, a.index)) {
+                        addEdge(*i, j);
+                     }
+                  }
+               }
+               if (a.kind == WRITE) {
+                  (known ? slot_writes[a.index] : any_writes).push_back(j);
+                  writes.push_back(j);
+                  pending_writes.push_back(j);
+               } else {
+                  (known ? slot_reads[a.index] : any_reads).push_back(j);
+                  reads.push_back(j);
+                  pending_reads.push_back(j);
+               }
+            } else if (a.kind == CALL || a.kind == ALLOC || a.kind == PRINT) {
+               if (last_barrier >= 0) {
+                  addEdge(last_barrier, j);
+               }
+               last_barrier = j;
+               if (a.kind != PRINT) {
+                  clobbers.push_back(j);
+                  for (const auto & w : pending_writes) {
+                     if (conflicts(a, accesses[w], primitives[j], aa)) {
+                        addEdge(w, j);
+                     }
+                  }
+               }
+               if (a.kind == CALL) {
+                  std::vector<unsigned long> still_pending;
+                  for (const auto & r : pending_reads) {
+                     if (conflicts(a, accesses[r], primitives[j], aa)) {
+                        addEdge(r, j);
+                     } else {
+                        still_pending.push_back(r);
+                     }
+                  }
+                  pending_reads = still_pending;
+                  pending_writes.clear();
+               }
+            }
+         }
+      }
+      const std::set<unsigned long> & preds(unsigned long i) { return _preds[i]; }
+      const std::set<unsigned long> & succs(unsigned long i) { return _succs[i]; }
+      unsigned long size() { return _preds.size(); }
+};
+
+#endif
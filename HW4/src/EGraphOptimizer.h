@@ -0,0 +1,392 @@
+#ifndef _CS_441_EGRAPH_OPTIMIZER_H
+#define _CS_441_EGRAPH_OPTIMIZER_H
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "CFG.h"
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "IdentityOptimizer.h"
+#include "RewriteRules.h"
+
+#define EGRAPH_NODE_LIMIT 4000
+#define EGRAPH_ITERATIONS 16
+#define EGRAPH_REWRITE_LIMIT 20000
+
+// Equality saturation over the arithmetic of each block, for -O3.
+// The arithmetic goes into an e-graph, where each class is a set of
+// expressions known to be equal, and the rewrites keep adding equal
+// expressions (commuting, reassociating, factoring a*b + a*c into
+// a*(b + c), cancelling (a + b) - b, and everything in RewriteRules)
+// until nothing new turns up or a limit is hit. Then every value the
+// rest of the method reads is pulled back out in its cheapest form,
+// at the place it was computed, from the registers defined before it.
+// The cost is one per instruction. With -vectorize the block is also
+// costed the way the vectorizer would pack it, and the result is only
+// used if it comes out cheaper than what the block had.
+// Expects SSA form, so each register has a single definition.
+class EGraphOptimizer : public IdentityOptimizer
+{
+   private:
+      // op is 'r' for a register or 'c' for a constant, named by reg
+      struct ENode {
+         char op;
+         std::string reg;
+         unsigned long a;
+         unsigned long b;
+      };
+      bool _vectorize;
+      unsigned long _width;
+      // A class is named by the lowest node in it (union-find)
+      std::vector<ENode> _nodes;
+      std::vector<unsigned long> _parent;
+      std::map<std::tuple<char, std::string, unsigned long, unsigned long>, unsigned long> _hashcons;
+      std::map<unsigned long, std::vector<unsigned long>> _members;
+      std::map<unsigned long, std::string> _constant;
+      // Where the block defines each register, registers from elsewhere are not there
+      std::map<std::string, unsigned long> _defined_at;
+      // Classes already in a register, or a constant
+      std::map<unsigned long, std::string> _materialized;
+      std::vector<unsigned long> _cost;
+      std::vector<unsigned long> _best;
+      unsigned long _next_temp;
+      std::map<ArithmeticPrimitive*, std::vector<std::shared_ptr<PrimitiveStatement>>> _rewrite;
+      std::set<ArithmeticPrimitive*> _dropped;
+      // A division can fail, so it stays where it is and its result is
+      // a leaf like any other register the block defines
+      static bool arithmetic(ArithmeticPrimitive * ap) {
+         return ap != nullptr && (RewriteRules::commutative(ap->op()) || ap->op() == '-');
+      }
+      unsigned long find(unsigned long n) {
+         while (_parent[n] != n) {
+            _parent[n] = _parent[_parent[n]];
+            n = _parent[n];
+         }
+         return n;
+      }
+      unsigned long add(char op, std::string reg, unsigned long a, unsigned long b) {
+         a = op == 'r' || op == 'c' ? 0 : find(a);
+         b = op == 'r' || op == 'c' ? 0 : find(b);
+         std::tuple<char, std::string, unsigned long, unsigned long> key = std::make_tuple(op, reg, a, b);
+         auto it = _hashcons.find(key);
+         if (it != _hashcons.end()) {
+            return find(it->second);
+         }
+         _nodes.push_back({ op, reg, a, b });
+         _parent.push_back(_nodes.size() - 1);
+         _hashcons[key] = _nodes.size() - 1;
+         return _nodes.size() - 1;
+      }
+      unsigned long leaf(std::string reg) {
+         return add(isNumber(reg) ? 'c' : 'r', reg, 0, 0);
+      }
+      bool merge(unsigned long x, unsigned long y) {
+         x = find(x);
+         y = find(y);
+         if (x == y) {
+            return false;
+         }
+         _parent[std::max(x, y)] = std::min(x, y);
+         return true;
+      }
+      // Merges the classes two nodes with the same op and classes are in
+      // until there are none, and indexes what each class has
+      void rebuild() {
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            _hashcons.clear();
+            for (unsigned long i=0; i<_nodes.size(); i++) {
+               ENode & n = _nodes[i];
+               bool operands = n.op != 'r' && n.op != 'c';
+               std::tuple<char, std::string, unsigned long, unsigned long> key =
+                  std::make_tuple(n.op, n.reg, operands ? find(n.a) : 0, operands ? find(n.b) : 0);
+               auto it = _hashcons.find(key);
+               if (it == _hashcons.end()) {
+                  _hashcons[key] = i;
+               } else if (merge(it->second, i)) {
+                  changed = true;
+               }
+            }
+         }
+         _members.clear();
+         _constant.clear();
+         for (unsigned long i=0; i<_nodes.size(); i++) {
+            _members[find(i)].push_back(i);
+            if (_nodes[i].op == 'c') {
+               _constant[find(i)] = _nodes[i].reg;
+            }
+         }
+      }
+      // Classes as RewriteRules operands, constants as themselves
+      std::string name(unsigned long c) {
+         c = find(c);
+         return _constant.count(c) ? _constant[c] : "#" + std::to_string(c);
+      }
+      unsigned long named(std::string s) {
+         return isNumber(s) ? leaf(s) : find(std::stoul(s.substr(1)));
+      }
+      bool rewrite(unsigned long i) {
+         ENode n = _nodes[i];
+         unsigned long self = find(i);
+         unsigned long a = find(n.a);
+         unsigned long b = find(n.b);
+         bool changed = false;
+         RewriteRules::Result r = RewriteRules::simplify(n.op, name(a), name(b));
+         if (r.op == '=') {
+            changed = merge(self, named(r.op1)) || changed;
+         } else {
+            changed = merge(self, add(r.op, "", named(r.op1), named(r.op2))) || changed;
+         }
+         if (RewriteRules::commutative(n.op)) {
+            changed = merge(self, add(n.op, "", b, a)) || changed;
+         }
+         std::vector<unsigned long> as = _members[a];
+         std::vector<unsigned long> bs = _members[b];
+         for (const auto & m : as) {
+            ENode x = _nodes[m];
+            // (x op y) op b is x op (y op b)
+            if (RewriteRules::commutative(n.op) && x.op == n.op) {
+               changed = merge(self, add(n.op, "", x.a, add(n.op, "", x.b, b))) || changed;
+            }
+            // (x + y) - y and (x - y) + y are x
+            if ((n.op == '-' && x.op == '+') || (n.op == '+' && x.op == '-')) {
+               if (find(x.b) == b) {
+                  changed = merge(self, x.a) || changed;
+               }
+            }
+            // x * y + x is x * (y + 1)
+            if (n.op == '+' && x.op == '*' && find(x.a) == b) {
+               changed = merge(self, add('*', "", x.a, add('+', "", x.b, leaf("1")))) || changed;
+            }
+            // x * y +- x * z is x * (y +- z), same for & over | and | over &
+            char inner = n.op == '+' || n.op == '-' ? '*' : n.op == '|' ? '&' : n.op == '&' ? '|' : 0;
+            if (inner == 0 || x.op != inner) {
+               continue;
+            }
+            for (const auto & k : bs) {
+               ENode y = _nodes[k];
+               if (y.op == inner && find(x.a) == find(y.a)) {
+                  changed = merge(self, add(inner, "", x.a, add(n.op, "", x.b, y.b))) || changed;
+               }
+            }
+         }
+         return changed;
+      }
+      // Limits are on work done, not time, so the result never depends
+      // on how busy the machine is
+      void saturate() {
+         unsigned long rewrites = 0;
+         for (unsigned long iteration=0; iteration<EGRAPH_ITERATIONS; iteration++) {
+            rebuild();
+            unsigned long size = _nodes.size();
+            bool changed = false;
+            for (unsigned long i=0; i<size && _nodes.size() < EGRAPH_NODE_LIMIT && rewrites < EGRAPH_REWRITE_LIMIT; i++) {
+               if (_nodes[i].op != 'r' && _nodes[i].op != 'c') {
+                  changed = rewrite(i) || changed;
+                  rewrites++;
+               }
+            }
+            if ((!changed && _nodes.size() == size) || _nodes.size() >= EGRAPH_NODE_LIMIT || rewrites >= EGRAPH_REWRITE_LIMIT) {
+               break;
+            }
+         }
+         rebuild();
+      }
+      // Cheapest node of every class using only what is defined before
+      // statement at, what's already materialized costs nothing
+      void extract(unsigned long at) {
+         const unsigned long NONE = (unsigned long) -1;
+         _cost.assign(_nodes.size(), NONE);
+         _best.assign(_nodes.size(), NONE);
+         for (const auto & kv : _materialized) {
+            _cost[kv.first] = 0;
+         }
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            for (unsigned long i=0; i<_nodes.size(); i++) {
+               ENode & n = _nodes[i];
+               unsigned long c = find(i);
+               unsigned long cost = NONE;
+               if (n.op == 'c') {
+                  cost = 0;
+               } else if (n.op == 'r') {
+                  cost = !_defined_at.count(n.reg) || _defined_at[n.reg] < at ? 0 : NONE;
+               } else if (_cost[find(n.a)] != NONE && _cost[find(n.b)] != NONE) {
+                  cost = 1 + _cost[find(n.a)] + _cost[find(n.b)];
+               }
+               if (cost < _cost[c]) {
+                  _cost[c] = cost;
+                  _best[c] = i;
+                  changed = true;
+               }
+            }
+         }
+      }
+      std::string emit(unsigned long c, std::string lhs, std::vector<std::shared_ptr<PrimitiveStatement>> & out) {
+         c = find(c);
+         if (_materialized.count(c)) {
+            return _materialized[c];
+         }
+         ENode n = _nodes[_best[c]];
+         if (n.op == 'r' || n.op == 'c') {
+            return n.reg;
+         }
+         std::string a = emit(n.a, "", out);
+         std::string b = emit(n.b, "", out);
+         std::string reg = lhs != "" ? lhs : toRegister(std::to_string(_next_temp++));
+         out.push_back(std::make_shared<ArithmeticPrimitive>(reg, a, n.op, b));
+         _materialized[c] = reg;
+         return reg;
+      }
+      // Instructions some arithmetic takes, vectorized if it will be:
+      // operations with the same op and depth are packed, and a vector
+      // takes a vecload per operand at the bottom and a vecstore if any
+      // lane is read elsewhere, unless that is more than the lanes
+      unsigned long estimate(const std::vector<std::shared_ptr<PrimitiveStatement>> & stmts, const std::set<std::string> & live) {
+         std::map<std::string, unsigned long> depth;
+         std::map<std::pair<char, unsigned long>, std::pair<unsigned long, bool>> packs;
+         unsigned long copies = 0;
+         unsigned long cost = 0;
+         for (const auto & s : stmts) {
+            ArithmeticPrimitive * ap = dynamic_cast<ArithmeticPrimitive*>(s.get());
+            // Copies are free after value numbering, but it might not run
+            if (dynamic_cast<AssignmentPrimitive*>(s.get()) != nullptr) {
+               copies++;
+            }
+            if (!arithmetic(ap)) {
+               continue;
+            }
+            cost++;
+            unsigned long d = 1 + std::max(depth[ap->op1()], depth[ap->op2()]);
+            depth[ap->lhs()] = d;
+            std::pair<unsigned long, bool> & p = packs[std::make_pair(ap->op(), d)];
+            p.first++;
+            p.second = p.second || live.find(ap->lhs()) != live.end();
+         }
+         if (!_vectorize) {
+            return cost + copies;
+         }
+         cost = 0;
+         for (const auto & kv : packs) {
+            char op = kv.first.first;
+            unsigned long vector = 1 + (kv.first.second == 1 ? 2 : 0) + (kv.second.second ? 1 : 0);
+            bool vectorizes = op == '+' || op == '-' || op == '*' || op == '/';
+            for (unsigned long lanes=kv.second.first; lanes>0; lanes-=std::min(lanes, _width)) {
+               cost += vectorizes ? std::min(std::min(lanes, _width), vector) : std::min(lanes, _width);
+            }
+         }
+         return cost + copies;
+      }
+      void optimizeArithmetic(std::shared_ptr<BasicBlock> block, std::map<std::string, unsigned long> & uses) {
+         std::vector<std::shared_ptr<PrimitiveStatement>> primitives = block->primitives();
+         _nodes.clear();
+         _parent.clear();
+         _hashcons.clear();
+         _materialized.clear();
+         _defined_at.clear();
+         // Register to its class, and reads of it by the block's arithmetic
+         std::map<std::string, unsigned long> classes;
+         std::map<std::string, unsigned long> inner;
+         std::vector<ArithmeticPrimitive*> ops;
+         std::vector<std::shared_ptr<PrimitiveStatement>> original;
+         for (unsigned long i=0; i<primitives.size(); i++) {
+            for (const auto & d : primitives[i]->LHS()) {
+               _defined_at[d] = i;
+            }
+            ArithmeticPrimitive * ap = dynamic_cast<ArithmeticPrimitive*>(primitives[i].get());
+            if (!arithmetic(ap)) {
+               continue;
+            }
+            unsigned long a = classes.count(ap->op1()) ? classes[ap->op1()] : leaf(ap->op1());
+            unsigned long b = classes.count(ap->op2()) ? classes[ap->op2()] : leaf(ap->op2());
+            classes[ap->lhs()] = add(ap->op(), "", a, b);
+            inner[ap->op1()]++;
+            inner[ap->op2()]++;
+            ops.push_back(ap);
+            original.push_back(primitives[i]);
+         }
+         if (ops.size() < 2) {
+            return;
+         }
+         // Values read by something other than the block's arithmetic
+         std::set<std::string> live;
+         for (const auto & ap : ops) {
+            if (uses[ap->lhs()] > inner[ap->lhs()]) {
+               live.insert(ap->lhs());
+            }
+         }
+         saturate();
+         unsigned long next_temp = _next_temp;
+         std::vector<std::shared_ptr<PrimitiveStatement>> extracted;
+         std::map<ArithmeticPrimitive*, std::vector<std::shared_ptr<PrimitiveStatement>>> rewrite;
+         for (unsigned long i=0; i<primitives.size(); i++) {
+            ArithmeticPrimitive * ap = dynamic_cast<ArithmeticPrimitive*>(primitives[i].get());
+            if (!arithmetic(ap) || live.find(ap->lhs()) == live.end()) {
+               continue;
+            }
+            extract(i);
+            std::vector<std::shared_ptr<PrimitiveStatement>> & out = rewrite[ap];
+            unsigned long c = find(classes[ap->lhs()]);
+            std::string reg = emit(c, ap->lhs(), out);
+            if (reg != ap->lhs()) {
+               // Already computed, or a leaf, value numbering drops the copy
+               out.push_back(std::make_shared<AssignmentPrimitive>(ap->lhs(), reg));
+            }
+            _materialized[c] = ap->lhs();
+            extracted.insert(extracted.end(), out.begin(), out.end());
+         }
+         if (estimate(extracted, live) >= estimate(original, live)) {
+            _next_temp = next_temp;
+            return;
+         }
+         for (const auto & ap : ops) {
+            if (rewrite.find(ap) == rewrite.end()) {
+               _dropped.insert(ap);
+            }
+         }
+         _rewrite.insert(rewrite.begin(), rewrite.end());
+      }
+   public:
+      EGraphOptimizer(bool vectorize = false, unsigned long width = UNROLL_SIZE) : _vectorize(vectorize), _width(width) {}
+      void visit(ArithmeticPrimitive& node) {
+         if (_dropped.find(&node) != _dropped.end()) {
+            return;
+         }
+         if (_rewrite.find(&node) == _rewrite.end()) {
+            IdentityOptimizer::visit(node);
+            return;
+         }
+         for (auto & p : _rewrite[&node]) {
+            _new_block->appendPrimitive(p);
+         }
+      }
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         _rewrite.clear();
+         _dropped.clear();
+         _next_temp = CFGLinker::nextTemporary(blockmap);
+         std::map<std::string, unsigned long> uses;
+         for (const auto & kv : blockmap) {
+            for (const auto & p : kv.second->primitives()) {
+               for (const auto & r : p->RHS()) {
+                  uses[r]++;
+               }
+            }
+            for (const auto & r : kv.second->control()->RHS()) {
+               uses[r]++;
+            }
+         }
+         for (const auto & kv : blockmap) {
+            optimizeArithmetic(kv.second, uses);
+         }
+         IdentityOptimizer::visit(node);
+      }
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _CS_441_FIELD_LAYOUT_H
+#define _CS_441_FIELD_LAYOUT_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AST.h"
+#include "CFG.h"
+#include "DominatorSolver.h"
+#include "Profile.h"
+
+// Picks the order of each class's field slots for -fieldlayout, the CFG
+// builder lays them out alphabetically unless it is given one.
+// By affinity, fields accessed in the same methods go next to each other
+// so they share cache lines and the vectorizer finds them adjacent. Each
+// access counts once, or as often as its block ran with a profile, and
+// two fields are as close as the fewer accesses of the two in a method.
+// Starting from the most accessed field, the closest field left to the
+// last one placed goes next, and fields nothing accesses go last.
+class FieldLayout
+{
+   private:
+      Profile _profile;
+      // Times a block ran. The profile has no count for blocks the passes
+      // merged away, those ran as often as their only predecessor.
+      unsigned long weight(std::string method, std::shared_ptr<BasicBlock> block) {
+         if (_profile.empty()) {
+            return 1;
+         }
+         std::set<std::string> seen;
+         while (!_profile.known(method, block->label())) {
+            std::vector<std::weak_ptr<BasicBlock>> preds = block->predecessors();
+            if (preds.size() != 1 || !seen.insert(block->label()).second) {
+               return 0;
+            }
+            block = preds[0].lock();
+         }
+         return _profile.count(method, block->label());
+      }
+   public:
+      FieldLayout(Profile profile = Profile()) : _profile(profile) {}
+      std::map<std::string, std::vector<std::string>> declared(std::shared_ptr<ProgramDeclaration> p) {
+         std::map<std::string, std::vector<std::string>> order;
+         for (auto & kv : p->classes()) {
+            order[kv.first] = kv.second->field_order();
+         }
+         return order;
+      }
+      // Orders from the accesses in cfg, built from p in any layout
+      std::map<std::string, std::vector<std::string>> affinity(std::shared_ptr<ProgramDeclaration> p, std::shared_ptr<ProgramCFG> cfg) {
+         std::map<std::string, std::shared_ptr<ClassCFG>> classes = cfg->classes();
+         std::vector<std::shared_ptr<MethodCFG>> methods = { cfg->main_method() };
+         for (auto & kv : classes) {
+            for (auto & m : kv.second->methods()) {
+               methods.push_back(m);
+            }
+         }
+         // Class to its fields' accesses, and to the closeness of two fields
+         std::map<std::string, std::map<std::string, unsigned long>> heat;
+         std::map<std::string, std::map<std::pair<std::string, std::string>, unsigned long>> close;
+         for (auto & m : methods) {
+            std::map<std::string, std::string> var_to_type = m->var_to_type();
+            std::map<std::string, std::map<std::string, unsigned long>> accesses;
+            DominatorSolver ds;
+            for (auto & kv : ds.solveBlockmap(m)) {
+               unsigned long w = weight(m->first_block()->label(), kv.second);
+               for (auto & s : kv.second->primitives()) {
+                  GetEltPrimitive * ge = dynamic_cast<GetEltPrimitive*>(s.get());
+                  SetEltPrimitive * se = dynamic_cast<SetEltPrimitive*>(s.get());
+                  std::string arr = ge != nullptr ? ge->arr() : se != nullptr ? se->arr() : "";
+                  std::string index = ge != nullptr ? ge->index() : se != nullptr ? se->index() : "";
+                  std::string type = var_to_type[arr];
+                  if (arr == "" || classes.find(type) == classes.end() || !isNumber(index)) {
+                     continue;
+                  }
+                  for (auto & f : classes[type]->field_table()) {
+                     if (std::to_string(f.second) == index) {
+                        accesses[type][f.first] += w;
+                     }
+                  }
+               }
+            }
+            for (auto & c : accesses) {
+               for (auto & f : c.second) {
+                  heat[c.first][f.first] += f.second;
+                  for (auto & g : c.second) {
+                     if (f.first != g.first) {
+                        close[c.first][std::make_pair(f.first, g.first)] += std::min(f.second, g.second);
+                     }
+                  }
+               }
+            }
+         }
+         std::map<std::string, std::vector<std::string>> order;
+         for (auto & kv : p->classes()) {
+            std::string c = kv.first;
+            std::vector<std::string> left = kv.second->field_order();
+            while (!left.empty()) {
+               auto best = left.begin();
+               for (auto f = left.begin(); f != left.end(); f++) {
+                  unsigned long f_close = order[c].empty() ? 0 : close[c][std::make_pair(order[c].back(), *f)];
+                  unsigned long best_close = order[c].empty() ? 0 : close[c][std::make_pair(order[c].back(), *best)];
+                  if (f_close > best_close || (f_close == best_close && heat[c][*f] > heat[c][*best])) {
+                     best = f;
+                  }
+               }
+               order[c].push_back(*best);
+               left.erase(best);
+            }
+         }
+         return order;
+      }
+};
+
+#endif
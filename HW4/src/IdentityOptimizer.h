@@ -2,6 +2,16 @@
 #define _CS_441_IDENTITY_OPTIMIZER_H
 #include "CFG.h"
 
+// An optimizer found the CFG in a state it can't handle
+class OptimizerException : public std::exception
+{
+   private:
+      std::string _info;
+   public:
+      OptimizerException(std::string info): _info(info) {}
+      std::string info() { return _info; }
+};
+
 // Build new CFG identical to previous doing a graph traversal
 // Intent is to inherit in actual optimizers, and only change
 // functions that matter (so that you don't have to override
@@ -79,6 +89,18 @@ class IdentityOptimizer : public CFGVisitor
       void visit(DivideVectorPrimitive& node) {
          _new_block->appendPrimitive(std::make_shared<DivideVectorPrimitive>(node.lhs(), node.op1(), node.op2()));
       }
+      void visit(ReduceVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<ReduceVectorPrimitive>(node.lhs(), node.op(), node.rhs()));
+      }
+      void visit(GetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<GetEltVectorPrimitive>(node.lhs(), node.arr(), node.index(), node.width()));
+      }
+      void visit(SetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<SetEltVectorPrimitive>(node.arr(), node.index(), node.val()));
+      }
+      void visit(ShuffleVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<ShuffleVectorPrimitive>(node.lhs(), node.rhs(), node.indices()));
+      }
       void visit(FailControl& node) {
          _new_block->setControl(std::make_shared<FailControl>(node.message()));
       }
@@ -91,6 +113,9 @@ class IdentityOptimizer : public CFGVisitor
       void visit(RetControl& node) {
          _new_block->setControl(std::make_shared<RetControl>(node.val()));
       }
+      void visit(TailCallControl& node) {
+         _new_block->setControl(std::make_shared<TailCallControl>(node.codeaddr(), node.receiver(), node.args()));
+      }
       void optimizeBlock(BasicBlock& node) {
          std::string label = node.label();
          if (!_label_to_block.count(label)) {
@@ -182,6 +207,9 @@ class IdentityOptimizer : public CFGVisitor
             kv.second->accept(*this);
             _new_prog->appendClass(_new_class);
          }
+         for (auto & kv : node.globals()) {
+            _new_prog->appendGlobal(kv.first, kv.second);
+         }
       }
       std::shared_ptr<ProgramCFG> optimize(std::shared_ptr<ProgramCFG> p) {
          // Optimize program
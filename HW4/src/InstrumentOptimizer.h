@@ -0,0 +1,95 @@
+#ifndef _CS_441_INSTRUMENT_OPTIMIZER_H
+#define _CS_441_INSTRUMENT_OPTIMIZER_H
+#include <map>
+#include <string>
+#include <vector>
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "IdentityOptimizer.h"
+
+#define COUNTER_ARRAY "counters"
+
+// Counts how often every block, call and allocation runs, for making
+// a profile to feed back in with -profile-use. The counters are a
+// global array, each bumped with a getelt, an add and a setelt where
+// it counts (after the phis of a block, right before a call or alloc),
+// and main prints all of them before it returns. sites() says which
+// counter is which, as the profile record it becomes minus the count.
+class InstrumentOptimizer : public IdentityOptimizer
+{
+   private:
+      std::vector<std::string> _sites;
+      unsigned long _next_temp;
+      std::string temp() {
+         return toRegister(std::to_string(_next_temp++));
+      }
+      void bump(std::shared_ptr<BasicBlock> block, std::string site) {
+         std::string index = std::to_string(_sites.size());
+         _sites.push_back(site);
+         std::string count = temp();
+         std::string bumped = temp();
+         block->appendPrimitive(std::make_shared<GetEltPrimitive>(count, toGlobal(COUNTER_ARRAY), index));
+         block->appendPrimitive(std::make_shared<ArithmeticPrimitive>(bumped, count, '+', "1"));
+         block->appendPrimitive(std::make_shared<SetEltPrimitive>(toGlobal(COUNTER_ARRAY), index, bumped));
+      }
+   public:
+      std::vector<std::string> sites() {
+         return _sites;
+      }
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         std::string name = order[0];
+         _next_temp = CFGLinker::nextTemporary(blockmap);
+         std::vector<std::shared_ptr<BasicBlock>> blocks;
+         for (const auto & label : order) {
+            std::shared_ptr<BasicBlock> block = blockmap[label];
+            std::shared_ptr<BasicBlock> new_block = std::make_shared<BasicBlock>(label, block->params());
+            std::vector<std::shared_ptr<PrimitiveStatement>> primitives = block->primitives();
+            unsigned long i = 0;
+            for (; i<primitives.size() && dynamic_cast<PhiPrimitive*>(primitives[i].get()) != nullptr; i++) {
+               new_block->appendPrimitive(primitives[i]);
+            }
+            bump(new_block, "block " + name + " " + label);
+            unsigned long calls = 0;
+            unsigned long allocs = 0;
+            for (; i<primitives.size(); i++) {
+               if (dynamic_cast<CallPrimitive*>(primitives[i].get()) != nullptr) {
+                  bump(new_block, "call " + name + " " + label + " " + std::to_string(calls++));
+               } else if (dynamic_cast<AllocPrimitive*>(primitives[i].get()) != nullptr) {
+                  bump(new_block, "alloc " + name + " " + label + " " + std::to_string(allocs++));
+               }
+               new_block->appendPrimitive(primitives[i]);
+            }
+            if (dynamic_cast<TailCallControl*>(block->control().get()) != nullptr) {
+               bump(new_block, "call " + name + " " + label + " " + std::to_string(calls++));
+            }
+            new_block->setControl(block->control());
+            blocks.push_back(new_block);
+         }
+         _new_method = linker.link(blocks, node.variables(), node.var_to_type());
+      }
+      void visit(ProgramCFG& node) {
+         _sites.clear();
+         IdentityOptimizer::visit(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(_new_prog->main_method());
+         _next_temp = CFGLinker::nextTemporary(blockmap);
+         for (const auto & kv : blockmap) {
+            if (dynamic_cast<RetControl*>(kv.second->control().get()) == nullptr) {
+               continue;
+            }
+            for (unsigned long i=0; i<_sites.size(); i++) {
+               std::string count = temp();
+               kv.second->appendPrimitive(std::make_shared<GetEltPrimitive>(count, toGlobal(COUNTER_ARRAY), std::to_string(i)));
+               kv.second->appendPrimitive(std::make_shared<PrintPrimitive>(count));
+            }
+         }
+         _new_prog->appendGlobal(COUNTER_ARRAY, std::vector<std::string>(_sites.size(), "0"));
+      }
+};
+
+#endif
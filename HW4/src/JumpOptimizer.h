@@ -1,83 +1,214 @@
 #ifndef _CS_441_JUMP_OPTIMIZER_H
 #define _CS_441_JUMP_OPTIMIZER_H
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
 #include "IdentityOptimizer.h"
 
+// Removes redundant jumps so blocks are as long as possible
+// Branches on a constant become jumps, jumps to an empty block that
+// only jumps on go straight to its target, and a block reached only by
+// a jump from one block is merged up into it. Phis naming a merged block
+// now name the block it was merged into, and unreachable blocks are gone.
 class JumpOptimizer : public IdentityOptimizer
 {
    private:
-      std::map<std::string, std::string> _jump_labels_to_prior;
-      std::map<std::string, std::string> _prune_labels_to_prior;
-   public:
-      void visit(JumpControl& node) {
-         IdentityOptimizer::visit(node);
-         // Might need to prune branch later
-         std::string label = node.branch();
-         _jump_labels_to_prior[label] = _new_block->label();
+      // Control with every edge to from going to to instead
+      std::shared_ptr<ControlStatement> retarget(std::shared_ptr<ControlStatement> control, std::string from, std::string to) {
+         JumpControl * jump = dynamic_cast<JumpControl*>(control.get());
+         IfElseControl * ifelse = dynamic_cast<IfElseControl*>(control.get());
+         if (jump != nullptr && jump->branch() == from) {
+            return std::make_shared<JumpControl>(to);
+         }
+         if (ifelse == nullptr || (ifelse->if_branch() != from && ifelse->else_branch() != from)) {
+            return control;
+         }
+         std::string if_branch = ifelse->if_branch() == from ? to : ifelse->if_branch();
+         std::string else_branch = ifelse->else_branch() == from ? to : ifelse->else_branch();
+         if (if_branch == else_branch) {
+            return std::make_shared<JumpControl>(if_branch);
+         }
+         return std::make_shared<IfElseControl>(ifelse->cond(), if_branch, else_branch);
       }
-      void visit(IfElseControl& node) {
-         IdentityOptimizer::visit(node);
-         // Might need to prune branch later
-         std::string if_label = node.if_branch();
-         std::string else_label = node.else_branch();
-         if (isNumber(node.cond())) {
-            int cond = std::stoi(node.cond());
-            if (cond) {
-               _jump_labels_to_prior[if_label] = _new_block->label();
-               _prune_labels_to_prior[else_label] = _new_block->label();
-            } else {
-               _jump_labels_to_prior[else_label] = _new_block->label();
-               _prune_labels_to_prior[if_label] = _new_block->label();
+      // Value a phi takes coming from label, or "" if it names no such edge
+      std::string incoming(PhiPrimitive * phi, std::string label) {
+         for (const auto & arg : phi->args()) {
+            if (arg.first == label) {
+               return arg.second;
             }
          }
+         return "";
       }
-      void visit(BasicBlock& node) {
-         // Optimize block and all children
-         IdentityOptimizer::visit(node);
-         // Check if we are a jump label
-         if (_jump_labels_to_prior.find(node.label()) != _jump_labels_to_prior.end()) {
-            // Check if we have only one predecessor
-            std::shared_ptr<BasicBlock> block = _label_to_block[node.label()];
-            if (block->predecessors().size() == 1) {
-               // Merge blocks up (postorder)
-               std::shared_ptr<BasicBlock> mergeIn = _label_to_block[_jump_labels_to_prior[node.label()]];
-               // Merge in primitives
-               for (const auto & p : block->primitives()) {
-                  mergeIn->appendPrimitive(p);
+      // Jumps to a block that does nothing but jump on go straight to where
+      // it jumps. A phi there now takes the forwarding block's value from
+      // each of its predecessors, which can't be done for a predecessor
+      // already jumping there with a different value, so that edge stays.
+      void thread(std::map<std::string, std::shared_ptr<BasicBlock>> & blocks, const std::vector<std::string> & order, std::string entry) {
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            std::map<std::string, std::set<std::string>> preds;
+            for (const auto & label : order) {
+               for (const auto & t : blocks[label]->control()->targets()) {
+                  preds[t].insert(label);
+               }
+            }
+            for (const auto & label : order) {
+               JumpControl * jump = dynamic_cast<JumpControl*>(blocks[label]->control().get());
+               if (label == entry || jump == nullptr || jump->branch() == label || !blocks[label]->primitives().empty()
+                  || preds[label].empty() || blocks.find(jump->branch()) == blocks.end()) {
+                  continue;
+               }
+               std::string target = jump->branch();
+               std::shared_ptr<BasicBlock> next = blocks[target];
+               for (const auto & pred : preds[label]) {
+                  bool threads = pred != label;
+                  for (const auto & p : next->primitives()) {
+                     PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+                     if (phi != nullptr) {
+                        threads = threads && incoming(phi, label) != ""
+                           && (preds[target].find(pred) == preds[target].end() || incoming(phi, pred) == incoming(phi, label));
+                     }
+                  }
+                  if (!threads) {
+                     continue;
+                  }
+                  std::vector<std::shared_ptr<PrimitiveStatement>> primitives;
+                  for (const auto & p : next->primitives()) {
+                     PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+                     if (phi == nullptr || preds[target].find(pred) != preds[target].end()) {
+                        primitives.push_back(p);
+                        continue;
+                     }
+                     // The forwarding block keeps its edge if others still use it
+                     std::vector<std::pair<std::string, std::string>> args = phi->args();
+                     args.push_back(std::make_pair(pred, incoming(phi, label)));
+                     primitives.push_back(std::make_shared<PhiPrimitive>(phi->lhs(), args));
+                  }
+                  std::shared_ptr<BasicBlock> threaded = std::make_shared<BasicBlock>(target, next->params());
+                  for (const auto & p : primitives) {
+                     threaded->appendPrimitive(p);
+                  }
+                  threaded->setControl(next->control());
+                  blocks[target] = threaded;
+                  next = threaded;
+                  blocks[pred]->setControl(retarget(blocks[pred]->control(), label, target));
+                  preds[target].insert(pred);
+                  changed = true;
                }
-               // Merge in control
-               mergeIn->setControl(block->control());
-               // Set new children
-               mergeIn->setChildren(block->children(), block->weak_children());
             }
          }
-         // Check if we are a prune label
-         if (_prune_labels_to_prior.find(node.label()) != _prune_labels_to_prior.end()) {
-            // Check if we have only one predecessor
-            std::shared_ptr<BasicBlock> block = _label_to_block[node.label()];
-            if (block->predecessors().size() == 1 && block->predecessors()[0].lock()->label() == _prune_labels_to_prior[node.label()]) {
-               // Remove block from children
-               std::shared_ptr<BasicBlock> removeFrom = _label_to_block[_prune_labels_to_prior[node.label()]];
-               std::vector<std::shared_ptr<BasicBlock>> children = removeFrom->children();
-               std::vector<std::shared_ptr<BasicBlock>> newChildren;
-               for (const auto & c : children) {
-                  if (c->label() != node.label()) {
-                     newChildren.push_back(c);
+      }
+   public:
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         std::string entry = order[0];
+         std::map<std::string, std::shared_ptr<BasicBlock>> new_blocks;
+         for (const auto & label : order) {
+            std::shared_ptr<BasicBlock> block = blockmap[label];
+            std::shared_ptr<BasicBlock> new_block = std::make_shared<BasicBlock>(label, block->params());
+            for (const auto & p : block->primitives()) {
+               new_block->appendPrimitive(p);
+            }
+            std::shared_ptr<ControlStatement> control = block->control();
+            IfElseControl * ifelse = dynamic_cast<IfElseControl*>(control.get());
+            if (ifelse != nullptr && isNumber(ifelse->cond())) {
+               // Prune the branch never taken
+               control = std::make_shared<JumpControl>(std::stoi(ifelse->cond()) ? ifelse->if_branch() : ifelse->else_branch());
+            } else if (ifelse != nullptr && ifelse->if_branch() == ifelse->else_branch()) {
+               control = std::make_shared<JumpControl>(ifelse->if_branch());
+            }
+            new_block->setControl(control);
+            new_blocks[label] = new_block;
+         }
+         thread(new_blocks, order, entry);
+         // Predecessors through the pruned controls, from reachable blocks only
+         std::map<std::string, std::set<std::string>> preds;
+         std::vector<std::string> worklist = { entry };
+         std::set<std::string> reachable = { entry };
+         while (!worklist.empty()) {
+            std::string label = worklist.back();
+            worklist.pop_back();
+            for (const auto & t : new_blocks[label]->control()->targets()) {
+               if (new_blocks.find(t) == new_blocks.end()) {
+                  continue;
+               }
+               preds[t].insert(label);
+               if (reachable.insert(t).second) {
+                  worklist.push_back(t);
+               }
+            }
+         }
+         // Merged block to the block it now lives in
+         std::map<std::string, std::string> merged;
+         for (const auto & label : order) {
+            if (reachable.find(label) == reachable.end() || merged.find(label) != merged.end()) {
+               continue;
+            }
+            std::shared_ptr<BasicBlock> block = new_blocks[label];
+            JumpControl * jump = dynamic_cast<JumpControl*>(block->control().get());
+            // Block whose jump was absorbed last, phis in next name it
+            std::string from = label;
+            while (jump != nullptr && jump->branch() != entry && jump->branch() != label && preds[jump->branch()].size() == 1) {
+               std::string next = jump->branch();
+               for (const auto & p : new_blocks[next]->primitives()) {
+                  PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+                  if (phi != nullptr) {
+                     // Only one way in, the phi is just a copy
+                     std::string val = incoming(phi, from);
+                     if (val == "") {
+                        throw OptimizerException("Phi for " + phi->lhs() + " in " + next + " has no value from its only predecessor " + from);
+                     }
+                     block->appendPrimitive(std::make_shared<AssignmentPrimitive>(phi->lhs(), val));
+                  } else {
+                     block->appendPrimitive(p);
                   }
                }
-               std::vector<std::weak_ptr<BasicBlock>> wchildren = removeFrom->weak_children();
-               std::vector<std::weak_ptr<BasicBlock>> newWChildren;
-               for (const auto & wc : wchildren) {
-                  if (wc.lock()->label() != node.label()) {
-                     newWChildren.push_back(wc);
+               block->setControl(new_blocks[next]->control());
+               merged[next] = label;
+               from = next;
+               jump = dynamic_cast<JumpControl*>(block->control().get());
+            }
+         }
+         std::vector<std::shared_ptr<BasicBlock>> blocks;
+         for (const auto & label : order) {
+            if (reachable.find(label) == reachable.end() || merged.find(label) != merged.end()) {
+               continue;
+            }
+            std::shared_ptr<BasicBlock> block = new_blocks[label];
+            std::shared_ptr<BasicBlock> new_block = std::make_shared<BasicBlock>(label, block->params());
+            for (const auto & p : block->primitives()) {
+               PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+               if (phi == nullptr) {
+                  new_block->appendPrimitive(p);
+                  continue;
+               }
+               std::vector<std::pair<std::string, std::string>> args;
+               for (const auto & arg : phi->args()) {
+                  // Edges from pruned branches are gone
+                  if (preds[label].find(arg.first) == preds[label].end()) {
+                     continue;
+                  }
+                  std::string pred = arg.first;
+                  while (merged.find(pred) != merged.end()) {
+                     pred = merged[pred];
                   }
+                  args.push_back(std::make_pair(pred, arg.second));
                }
-               // Set new children
-               removeFrom->setChildren(newChildren, newWChildren);
+               new_block->appendPrimitive(std::make_shared<PhiPrimitive>(phi->lhs(), args));
             }
+            new_block->setControl(block->control());
+            blocks.push_back(new_block);
          }
+         _new_method = linker.link(blocks, node.variables(), node.var_to_type());
       }
 };
 
 #endif
-
@@ -0,0 +1,119 @@
+#ifndef _CS_441_LAYOUT_OPTIMIZER_H
+#define _CS_441_LAYOUT_OPTIMIZER_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "IdentityOptimizer.h"
+#include "Profile.h"
+
+// Orders the blocks of each method so the likely path is laid out
+// straight and cold blocks are out of the way at the end. Starting from
+// the entry, each block is followed by its likeliest successor not
+// placed yet, and a new chain starts from the next block in the old
+// order when there is none. With a profile the likeliest successor is
+// the one that ran most, without one it is whichever loops back (so a
+// loop's body follows its header), then the then branch.
+// Cold blocks are the ones the profile never saw run, and those that
+// can only end in a fail (the badpointer and badfield checks), which
+// run at most once.
+class LayoutOptimizer : public IdentityOptimizer
+{
+   private:
+      Profile _profile;
+      std::string _method;
+      std::map<std::string, std::shared_ptr<BasicBlock>> _blocks;
+      // Blocks each block can get to
+      std::map<std::string, std::set<std::string>> _reaches;
+      std::set<std::string> _cold;
+      void reach(std::string from, std::string label) {
+         for (const auto & t : _blocks[label]->control()->targets()) {
+            if (_reaches[from].insert(t).second) {
+               reach(from, t);
+            }
+         }
+      }
+      // Blocks that never ran, and those every path from ends in a fail
+      void findCold(const std::vector<std::string> & order) {
+         _cold.clear();
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            for (const auto & label : order) {
+               if (_cold.find(label) != _cold.end()) {
+                  continue;
+               }
+               std::vector<std::string> targets = _blocks[label]->control()->targets();
+               bool fails = dynamic_cast<FailControl*>(_blocks[label]->control().get()) != nullptr;
+               bool all_cold = !targets.empty();
+               for (const auto & t : targets) {
+                  all_cold = all_cold && _cold.find(t) != _cold.end();
+               }
+               if (fails || all_cold || _profile.cold(_method, label)) {
+                  _cold.insert(label);
+                  changed = true;
+               }
+            }
+         }
+      }
+      bool likelier(std::string label, std::string a, std::string b) {
+         if (_profile.known(_method, a) && _profile.known(_method, b)) {
+            return _profile.count(_method, a) > _profile.count(_method, b);
+         }
+         bool a_loops = _reaches[a].find(label) != _reaches[a].end();
+         bool b_loops = _reaches[b].find(label) != _reaches[b].end();
+         return a_loops && !b_loops;
+      }
+      // Successor to lay out right after block, or "" if all are placed
+      std::string likeliest(std::string label, const std::set<std::string> & placed) {
+         std::string best = "";
+         for (const auto & t : _blocks[label]->control()->targets()) {
+            if (placed.find(t) != placed.end() || _cold.find(t) != _cold.end()) {
+               continue;
+            }
+            if (best == "" || likelier(label, t, best)) {
+               best = t;
+            }
+         }
+         return best;
+      }
+   public:
+      LayoutOptimizer(Profile profile = Profile()) : _profile(profile) {}
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         _blocks = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         _method = order[0];
+         _reaches.clear();
+         for (const auto & label : order) {
+            reach(label, label);
+         }
+         findCold(order);
+         std::set<std::string> placed;
+         std::vector<std::string> layout;
+         for (const auto & start : order) {
+            if (_cold.find(start) != _cold.end() && start != _method) {
+               continue;
+            }
+            std::string label = start;
+            while (label != "" && placed.find(label) == placed.end()) {
+               placed.insert(label);
+               layout.push_back(label);
+               label = likeliest(label, placed);
+            }
+         }
+         for (const auto & label : order) {
+            if (placed.find(label) == placed.end()) {
+               layout.push_back(label);
+            }
+         }
+         IdentityOptimizer::visit(node);
+         _new_method->setLayout(layout);
+      }
+};
+
+#endif
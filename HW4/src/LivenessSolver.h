@@ -0,0 +1,138 @@
+#ifndef _CS_441_LIVENESS_SOLVER_H
+#define _CS_441_LIVENESS_SOLVER_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFG.h"
+#include "DominatorSolver.h"
+
+// Backwards dataflow solver for live registers
+// Phi arguments are treated as used at the end of the matching
+// predecessor, and phi results as defined at the top of the block
+class LivenessSolver
+{
+   private:
+      std::map<std::string, std::shared_ptr<BasicBlock>> _blockmap;
+      std::map<std::string, std::set<std::string>> _live_in;
+      std::map<std::string, std::set<std::string>> _live_out;
+      // (block, predecessor) to registers read by phis along that edge
+      std::map<std::pair<std::string, std::string>, std::set<std::string>> _phi_uses;
+   public:
+      static std::vector<std::string> uses(std::shared_ptr<PrimitiveStatement> p) {
+         std::vector<std::string> regs;
+         if (dynamic_cast<PhiPrimitive*>(p.get()) != nullptr) {
+            return regs;
+         }
+         for (const auto & r : p->RHS()) {
+            if (isRegister(r)) {
+               regs.push_back(r);
+            }
+         }
+         return regs;
+      }
+      static std::vector<std::string> uses(std::shared_ptr<ControlStatement> c) {
+         std::vector<std::string> regs;
+         for (const auto & r : c->RHS()) {
+            if (isRegister(r)) {
+               regs.push_back(r);
+            }
+         }
+         return regs;
+      }
+      static std::vector<std::string> defs(std::shared_ptr<PrimitiveStatement> p) {
+         std::vector<std::string> regs;
+         for (const auto & r : p->LHS()) {
+            if (isRegister(r)) {
+               regs.push_back(r);
+            }
+         }
+         return regs;
+      }
+      // Step the live set backwards over a single primitive
+      static void step(std::set<std::string> & live, std::shared_ptr<PrimitiveStatement> p) {
+         for (const auto & d : defs(p)) {
+            live.erase(d);
+         }
+         for (const auto & u : uses(p)) {
+            live.insert(u);
+         }
+      }
+      std::vector<std::string> successors(std::string label) {
+         std::vector<std::string> succs;
+         for (const auto & t : _blockmap[label]->control()->targets()) {
+            if (_blockmap.find(t) != _blockmap.end() && std::find(succs.begin(), succs.end(), t) == succs.end()) {
+               succs.push_back(t);
+            }
+         }
+         return succs;
+      }
+      void solve(std::shared_ptr<MethodCFG> m) {
+         DominatorSolver ds;
+         solve(ds.solveBlockmap(m));
+      }
+      void solve(std::map<std::string, std::shared_ptr<BasicBlock>> blockmap) {
+         _blockmap = blockmap;
+         _live_in.clear();
+         _live_out.clear();
+         _phi_uses.clear();
+         for (const auto & kv : _blockmap) {
+            _live_in[kv.first] = std::set<std::string>({});
+            _live_out[kv.first] = std::set<std::string>({});
+            for (const auto & p : kv.second->primitives()) {
+               PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+               if (phi != nullptr) {
+                  for (const auto & arg : phi->args()) {
+                     if (isRegister(arg.second)) {
+                        _phi_uses[std::make_pair(kv.first, arg.first)].insert(arg.second);
+                     }
+                  }
+               }
+            }
+         }
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            for (const auto & kv : _blockmap) {
+               std::string label = kv.first;
+               std::set<std::string> out;
+               for (const auto & s : successors(label)) {
+                  out.insert(_live_in[s].begin(), _live_in[s].end());
+                  std::set<std::string> phi_uses = _phi_uses[std::make_pair(s, label)];
+                  out.insert(phi_uses.begin(), phi_uses.end());
+               }
+               std::set<std::string> in = out;
+               for (const auto & u : uses(kv.second->control())) {
+                  in.insert(u);
+               }
+               std::vector<std::shared_ptr<PrimitiveStatement>> primitives = kv.second->primitives();
+               for (auto it = primitives.rbegin(); it != primitives.rend(); it++) {
+                  step(in, *it);
+               }
+               if (out != _live_out[label] || in != _live_in[label]) {
+                  _live_out[label] = out;
+                  _live_in[label] = in;
+                  changed = true;
+               }
+            }
+         }
+      }
+      std::set<std::string> liveIn(std::string label) { return _live_in[label]; }
+      std::set<std::string> liveOut(std::string label) { return _live_out[label]; }
+      // Registers live just after the phis of a block
+      std::set<std::string> liveAfterPhis(std::string label) {
+         std::set<std::string> live = _live_out[label];
+         for (const auto & u : uses(_blockmap[label]->control())) {
+            live.insert(u);
+         }
+         std::vector<std::shared_ptr<PrimitiveStatement>> primitives = _blockmap[label]->primitives();
+         for (auto it = primitives.rbegin(); it != primitives.rend(); it++) {
+            if (dynamic_cast<PhiPrimitive*>(it->get()) == nullptr) {
+               step(live, *it);
+            }
+         }
+         return live;
+      }
+};
+
+#endif
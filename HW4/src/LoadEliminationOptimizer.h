@@ -0,0 +1,173 @@
+#ifndef _CS_441_LOAD_ELIMINATION_OPTIMIZER_H
+#define _CS_441_LOAD_ELIMINATION_OPTIMIZER_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AliasAnalysis.h"
+#include "CFG.h"
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "RenamingOptimizer.h"
+
+// Redundant load elimination and store to load forwarding
+// Forward dataflow over the value held in each (base, slot) we have
+// read or written, intersected at joins. A getelt or load of a slot
+// that is still available is dropped, and its result renamed to the
+// value we already have. Stores and calls kill whatever they may alias.
+// Expects value numbered SSA form, so equal bases share a register.
+class LoadEliminationOptimizer : public RenamingOptimizer
+{
+   private:
+      typedef std::map<std::pair<std::string, std::string>, std::string> Available;
+      AliasAnalysis _aa;
+      // Result of a dropped load to the value it is replaced with
+      std::map<std::string, std::string> _replace;
+      void kill(Available & avail, std::string base, std::string index) {
+         for (auto it = avail.begin(); it != avail.end(); ) {
+            if (_aa.mayAlias(it->first.first, it->first.second, base, index)) {
+               it = avail.erase(it);
+            } else {
+               it++;
+            }
+         }
+      }
+      void read(Available & avail, std::string lhs, std::string base, std::string index, bool record) {
+         std::pair<std::string, std::string> loc = std::make_pair(base, index);
+         if (avail.find(loc) != avail.end()) {
+            if (record) {
+               _replace[lhs] = avail[loc];
+            }
+         } else {
+            avail[loc] = lhs;
+         }
+      }
+      void write(Available & avail, std::string base, std::string index, std::string val) {
+         kill(avail, base, index);
+         avail[std::make_pair(base, index)] = val;
+      }
+      void transfer(Available & avail, std::shared_ptr<PrimitiveStatement> p, bool record) {
+         if (!AliasAnalysis::touchesMemory(p)) {
+            return;
+         }
+         GetEltPrimitive * getelt = dynamic_cast<GetEltPrimitive*>(p.get());
+         SetEltPrimitive * setelt = dynamic_cast<SetEltPrimitive*>(p.get());
+         LoadPrimitive * load = dynamic_cast<LoadPrimitive*>(p.get());
+         StorePrimitive * store = dynamic_cast<StorePrimitive*>(p.get());
+         CallPrimitive * call = dynamic_cast<CallPrimitive*>(p.get());
+         // load and store are slot 0, operands are looked up through
+         // loads already dropped so chained accesses match up
+         if (getelt != nullptr) {
+            read(avail, getelt->lhs(), rename(getelt->arr()), rename(getelt->index()), record);
+         } else if (load != nullptr) {
+            read(avail, load->lhs(), rename(load->addr()), "0", record);
+         } else if (setelt != nullptr) {
+            write(avail, rename(setelt->arr()), rename(setelt->index()), rename(setelt->val()));
+         } else if (store != nullptr) {
+            write(avail, rename(store->addr()), "0", rename(store->val()));
+         } else if (call != nullptr) {
+            for (auto it = avail.begin(); it != avail.end(); ) {
+               if (_aa.callMayWrite(call, it->first.first, it->first.second)) {
+                  it = avail.erase(it);
+               } else {
+                  it++;
+               }
+            }
+         } else {
+            avail.clear();
+         }
+      }
+   protected:
+      std::string rename(std::string reg) {
+         while (_replace.find(reg) != _replace.end()) {
+            reg = _replace[reg];
+         }
+         return reg;
+      }
+   public:
+      void visit(GetEltPrimitive& node) {
+         if (_replace.find(node.lhs()) == _replace.end()) {
+            RenamingOptimizer::visit(node);
+         }
+      }
+      void visit(LoadPrimitive& node) {
+         if (_replace.find(node.lhs()) == _replace.end()) {
+            RenamingOptimizer::visit(node);
+         }
+      }
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         _aa.setMethod(method);
+         _replace.clear();
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         std::map<std::string, std::vector<std::string>> preds;
+         for (const auto & label : order) {
+            for (const auto & t : blockmap[label]->control()->targets()) {
+               if (blockmap.find(t) != blockmap.end()) {
+                  preds[t].push_back(label);
+               }
+            }
+         }
+         // Available on entry to a block, from the visited predecessors
+         std::map<std::string, Available> out;
+         auto in = [&] (std::string label) {
+            Available avail;
+            bool first = true;
+            for (const auto & p : preds[label]) {
+               if (out.find(p) == out.end()) {
+                  continue;
+               }
+               if (first) {
+                  avail = out[p];
+                  first = false;
+                  continue;
+               }
+               for (auto it = avail.begin(); it != avail.end(); ) {
+                  auto other = out[p].find(it->first);
+                  if (other == out[p].end() || other->second != it->second) {
+                     it = avail.erase(it);
+                  } else {
+                     it++;
+                  }
+               }
+            }
+            return avail;
+         };
+         // Dropping a load can make a later access through it redundant
+         unsigned long replaced;
+         do {
+            replaced = _replace.size();
+            out.clear();
+            bool changed = true;
+            while (changed) {
+               changed = false;
+               for (const auto & label : order) {
+                  Available avail = in(label);
+                  for (const auto & p : blockmap[label]->primitives()) {
+                     transfer(avail, p, false);
+                  }
+                  if (out.find(label) == out.end() || out[label] != avail) {
+                     out[label] = avail;
+                     changed = true;
+                  }
+               }
+            }
+            for (const auto & label : order) {
+               Available avail = in(label);
+               for (const auto & p : blockmap[label]->primitives()) {
+                  transfer(avail, p, true);
+               }
+            }
+         } while (replaced != _replace.size());
+         IdentityOptimizer::visit(node);
+      }
+      void visit(ProgramCFG& node) {
+         _aa.analyze(node);
+         IdentityOptimizer::visit(node);
+      }
+};
+
+#endif
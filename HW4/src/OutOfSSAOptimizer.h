@@ -0,0 +1,314 @@
+#ifndef _CS_441_OUT_OF_SSA_OPTIMIZER_H
+#define _CS_441_OUT_OF_SSA_OPTIMIZER_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFG.h"
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "LivenessSolver.h"
+#include "RenamingOptimizer.h"
+
+// Translate out of SSA form
+// Every phi becomes a parallel copy at the end of its predecessor
+// (critical edges are split first so the copy only runs on that edge).
+// Copy related registers are then coalesced whenever they do not
+// interfere, and the remaining parallel copies are sequentialized.
+class OutOfSSAOptimizer : public RenamingOptimizer
+{
+   private:
+      unsigned long _split_counter = 0;
+      std::string _curr_label;
+      unsigned long _next_temp;
+      // Types of the scratch registers used to break copy cycles
+      std::map<std::string, std::string> _var_to_type;
+      // Union find over registers, each set is renamed to one register
+      std::map<std::string, std::string> _parent;
+      std::map<std::string, std::set<std::string>> _interference;
+      // Method parameters keep their names when coalesced
+      std::set<std::string> _params;
+      // Label to the parallel copy placed at the end of that block
+      std::map<std::string, std::vector<std::pair<std::string, std::string>>> _copies;
+      // Label to the phi block its parallel copy feeds
+      std::map<std::string, std::string> _copy_succ;
+      // (predecessor, successor) to the label of the block splitting that edge
+      std::map<std::pair<std::string, std::string>, std::string> _split_labels;
+      std::string find(std::string reg) {
+         if (_parent.find(reg) == _parent.end()) {
+            _parent[reg] = reg;
+            return reg;
+         }
+         std::string root = reg;
+         while (_parent[root] != root) {
+            root = _parent[root];
+         }
+         // Path compression
+         while (_parent[reg] != root) {
+            std::string next = _parent[reg];
+            _parent[reg] = root;
+            reg = next;
+         }
+         return root;
+      }
+      std::string rename(std::string reg) {
+         return isRegister(reg) ? find(reg) : reg;
+      }
+      std::string retarget(std::string label) {
+         std::pair<std::string, std::string> edge = std::make_pair(_curr_label, label);
+         return _split_labels.count(edge) ? _split_labels[edge] : label;
+      }
+      void interfere(std::string a, std::string b) {
+         if (a != b) {
+            _interference[a].insert(b);
+            _interference[b].insert(a);
+         }
+      }
+      // Aggressively merge the sets of two copy related registers
+      void coalesce(std::string a, std::string b) {
+         std::string ra = find(a);
+         std::string rb = find(b);
+         if (ra == rb || _interference[ra].find(rb) != _interference[ra].end()) {
+            return;
+         }
+         if (_params.find(rb) != _params.end()) {
+            std::swap(ra, rb);
+         }
+         _parent[rb] = ra;
+         for (const auto & n : _interference[rb]) {
+            _interference[n].erase(rb);
+            _interference[n].insert(ra);
+            _interference[ra].insert(n);
+         }
+         _interference.erase(rb);
+      }
+      // Every register written at a point interferes with everything live after it,
+      // except the source of a plain copy (they hold the same value)
+      void interfereDefs(std::set<std::string> & live, std::shared_ptr<PrimitiveStatement> p) {
+         std::string copy_src;
+         AssignmentPrimitive * a = dynamic_cast<AssignmentPrimitive*>(p.get());
+         if (a != nullptr) {
+            copy_src = a->rhs();
+         }
+         for (const auto & d : LivenessSolver::defs(p)) {
+            for (const auto & l : live) {
+               if (l != d && l != copy_src) {
+                  interfere(d, l);
+               }
+            }
+         }
+         LivenessSolver::step(live, p);
+      }
+      // Parallel copies write every destination at once
+      void interfereCopies(std::set<std::string> & live, std::vector<std::pair<std::string, std::string>> copies) {
+         std::set<std::string> dests;
+         for (const auto & c : copies) {
+            dests.insert(c.first);
+         }
+         for (const auto & c : copies) {
+            // The source is only the same value if the copy does not also overwrite it
+            bool src_kept = dests.find(c.second) == dests.end();
+            for (const auto & l : live) {
+               if (l != c.first && !(src_kept && l == c.second)) {
+                  interfere(c.first, l);
+               }
+            }
+         }
+         for (const auto & d : dests) {
+            live.erase(d);
+         }
+         for (const auto & c : copies) {
+            if (isRegister(c.second)) {
+               live.insert(c.second);
+            }
+         }
+      }
+      // Order a parallel copy so no source is overwritten before it is read
+      // Cycles (swaps) are broken with a fresh scratch register
+      std::vector<std::pair<std::string, std::string>> sequentialize(std::vector<std::pair<std::string, std::string>> copies) {
+         std::vector<std::pair<std::string, std::string>> pending;
+         std::vector<std::pair<std::string, std::string>> constants;
+         std::set<std::string> dests;
+         for (const auto & c : copies) {
+            std::string d = rename(c.first);
+            std::string s = rename(c.second);
+            if (d == s || dests.find(d) != dests.end()) {
+               continue;
+            }
+            dests.insert(d);
+            if (isRegister(s)) {
+               pending.push_back(std::make_pair(d, s));
+            } else {
+               // Constants read no register, write them last
+               constants.push_back(std::make_pair(d, s));
+            }
+         }
+         std::vector<std::pair<std::string, std::string>> sequence;
+         while (pending.size() > 0) {
+            bool emitted = false;
+            for (auto it = pending.begin(); it != pending.end(); it++) {
+               std::string d = it->first;
+               bool read = std::any_of(pending.begin(), pending.end(),
+                     [&] (std::pair<std::string, std::string> c) { return c.second == d; });
+               if (!read) {
+                  sequence.push_back(*it);
+                  pending.erase(it);
+                  emitted = true;
+                  break;
+               }
+            }
+            if (!emitted) {
+               // Only cycles remain, save one register and redirect its readers
+               std::string d = pending[0].first;
+               std::string scratch = toRegister(std::to_string(_next_temp++));
+               if (_var_to_type.find(d) != _var_to_type.end()) {
+                  _var_to_type[scratch] = _var_to_type[d];
+               }
+               sequence.push_back(std::make_pair(scratch, d));
+               for (auto & c : pending) {
+                  if (c.second == d) {
+                     c.second = scratch;
+                  }
+               }
+            }
+         }
+         sequence.insert(sequence.end(), constants.begin(), constants.end());
+         return sequence;
+      }
+      void appendCopies(std::string label) {
+         if (_copies.find(label) != _copies.end()) {
+            for (const auto & c : sequentialize(_copies[label])) {
+               _new_block->appendPrimitive(std::make_shared<AssignmentPrimitive>(c.first, c.second));
+            }
+         }
+      }
+   public:
+      void visit(PhiPrimitive& node) {
+         // Replaced by the parallel copies in the predecessors
+      }
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         LivenessSolver ls;
+         ls.solve(blockmap);
+         _parent.clear();
+         _interference.clear();
+         _copies.clear();
+         _copy_succ.clear();
+         _split_labels.clear();
+         std::vector<std::string> params = method->first_block()->params();
+         _params = std::set<std::string>(params.begin(), params.end());
+         // Turn phis into parallel copies, splitting edges out of branching predecessors
+         for (const auto & label : order) {
+            for (const auto & p : blockmap[label]->primitives()) {
+               PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+               if (phi == nullptr) {
+                  continue;
+               }
+               for (const auto & arg : phi->args()) {
+                  std::string pred = arg.first;
+                  if (blockmap.find(pred) == blockmap.end()) {
+                     continue;
+                  }
+                  std::string at = pred;
+                  if (ls.successors(pred).size() > 1) {
+                     std::pair<std::string, std::string> edge = std::make_pair(pred, label);
+                     if (!_split_labels.count(edge)) {
+                        _split_labels[edge] = "split" + std::to_string(++_split_counter);
+                     }
+                     at = _split_labels[edge];
+                  }
+                  _copies[at].push_back(std::make_pair(phi->lhs(), arg.second));
+                  _copy_succ[at] = label;
+               }
+            }
+         }
+         // Build the interference graph of the program with the copies in place
+         for (const auto & label : order) {
+            std::shared_ptr<BasicBlock> block = blockmap[label];
+            std::set<std::string> live;
+            if (_copies.find(label) != _copies.end()) {
+               live = ls.liveAfterPhis(_copy_succ[label]);
+            } else {
+               live = ls.liveOut(label);
+            }
+            for (const auto & u : LivenessSolver::uses(block->control())) {
+               live.insert(u);
+            }
+            if (_copies.find(label) != _copies.end()) {
+               interfereCopies(live, _copies[label]);
+            }
+            std::vector<std::shared_ptr<PrimitiveStatement>> primitives = block->primitives();
+            for (auto it = primitives.rbegin(); it != primitives.rend(); it++) {
+               if (dynamic_cast<PhiPrimitive*>(it->get()) == nullptr) {
+                  interfereDefs(live, *it);
+               }
+            }
+            if (label == order[0]) {
+               // Parameters (and anything else live on entry) are all defined at once
+               for (const auto & p : block->params()) {
+                  live.insert(p);
+               }
+               for (const auto & a : live) {
+                  for (const auto & b : live) {
+                     interfere(a, b);
+                  }
+               }
+            }
+         }
+         for (const auto & kv : _split_labels) {
+            std::set<std::string> live = ls.liveAfterPhis(kv.first.second);
+            interfereCopies(live, _copies[kv.second]);
+         }
+         // Coalesce phi copies first, then plain copies
+         for (const auto & kv : _copies) {
+            for (const auto & c : kv.second) {
+               if (isRegister(c.second)) {
+                  coalesce(c.first, c.second);
+               }
+            }
+         }
+         for (const auto & label : order) {
+            for (const auto & p : blockmap[label]->primitives()) {
+               AssignmentPrimitive * a = dynamic_cast<AssignmentPrimitive*>(p.get());
+               if (a != nullptr && isRegister(a->rhs())) {
+                  coalesce(a->lhs(), a->rhs());
+               }
+            }
+         }
+         // Rebuild the method with coalesced names and sequential copies
+         _next_temp = CFGLinker::nextTemporary(blockmap);
+         _var_to_type = node.var_to_type();
+         std::vector<std::shared_ptr<BasicBlock>> blocks;
+         for (const auto & label : order) {
+            std::shared_ptr<BasicBlock> block = blockmap[label];
+            std::vector<std::string> params;
+            for (const auto & p : block->params()) {
+               params.push_back(rename(p));
+            }
+            _curr_label = label;
+            _new_block = std::make_shared<BasicBlock>(label, params);
+            for (auto & p : block->primitives()) {
+               p->accept(*this);
+            }
+            appendCopies(label);
+            block->control()->accept(*this);
+            blocks.push_back(_new_block);
+            // Edge blocks follow their predecessor
+            for (const auto & kv : _split_labels) {
+               if (kv.first.first == label) {
+                  _new_block = std::make_shared<BasicBlock>(kv.second);
+                  appendCopies(kv.second);
+                  _new_block->setControl(std::make_shared<JumpControl>(kv.first.second));
+                  blocks.push_back(_new_block);
+               }
+            }
+         }
+         _new_method = linker.link(blocks, node.variables(), _var_to_type);
+      }
+};
+
+#endif
@@ -550,6 +550,7 @@ std::shared_ptr<ClassDeclaration> ProgramParser::parseClass(std::istream & input
    advanceAndExpectChar(input, '\n', "Class missing opening newline");
    skipWhitespaceAndNewlines(input);
    std::map<std::string, std::string> fields;
+   std::vector<std::string> field_order;
    if (input.peek() == 'f') {
       // Parse fields
       advanceAndExpectWord(input, "fields", "Class expected \"fields\" but got something else");
@@ -592,6 +593,7 @@ std::shared_ptr<ClassDeclaration> ProgramParser::parseClass(std::istream & input
                throw ParserException("field defined twice in same class");
             }
             fields[field] = className;
+            field_order.push_back(field);
             numArgs++;
          }
       }
@@ -612,7 +614,7 @@ std::shared_ptr<ClassDeclaration> ProgramParser::parseClass(std::istream & input
       }
       methods[key] = method;
    }
-   return std::make_shared<ClassDeclaration>(classname, fields, methods);
+   return std::make_shared<ClassDeclaration>(classname, fields, field_order, methods);
 }
 
 std::shared_ptr<ProgramDeclaration> ProgramParser::parse(std::istream & input) {
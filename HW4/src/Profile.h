@@ -0,0 +1,67 @@
+#ifndef _CS_441_PROFILE_H
+#define _CS_441_PROFILE_H
+#include <istream>
+#include <map>
+#include <sstream>
+#include <string>
+
+// Execution counts from a run of the program, for -profile-use.
+// One record a line, blank lines and lines starting with # are skipped:
+//    block METHOD LABEL COUNT          times the block was entered
+//    call METHOD LABEL INDEX COUNT     times the INDEXth call in the block ran
+//    alloc METHOD LABEL INDEX COUNT    same for allocations
+// Nothing reads call and alloc counts yet, so those records are checked
+// and dropped.
+// METHOD is the label of the method's first block (main for main), and
+// labels are the ones the CFG builder hands out, which the passes keep.
+// Blocks a pass made up have no count, so they are neither hot nor cold.
+class Profile
+{
+   private:
+      std::map<std::string, std::map<std::string, unsigned long>> _blocks;
+   public:
+      // False if a line is not a record, what was read before it is kept
+      bool load(std::istream & in) {
+         std::string line;
+         while (std::getline(in, line)) {
+            std::stringstream fields(line);
+            std::string kind, method, label;
+            unsigned long index = 0, count = 0;
+            if (!(fields >> kind) || kind[0] == '#') {
+               continue;
+            }
+            if (!(fields >> method >> label)) {
+               return false;
+            }
+            if (kind != "block" && !(fields >> index)) {
+               return false;
+            }
+            std::string rest;
+            if (!(fields >> count) || (fields >> rest)) {
+               return false;
+            }
+            if (kind == "block") {
+               _blocks[method][label] += count;
+            } else if (kind != "call" && kind != "alloc") {
+               return false;
+            }
+         }
+         return true;
+      }
+      bool empty() {
+         return _blocks.empty();
+      }
+      bool known(std::string method, std::string label) {
+         auto m = _blocks.find(method);
+         return m != _blocks.end() && m->second.find(label) != m->second.end();
+      }
+      unsigned long count(std::string method, std::string label) {
+         return known(method, label) ? _blocks[method][label] : 0;
+      }
+      // Profiled and never run
+      bool cold(std::string method, std::string label) {
+         return known(method, label) && count(method, label) == 0;
+      }
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef _CS_441_REASSOCIATION_OPTIMIZER_H
+#define _CS_441_REASSOCIATION_OPTIMIZER_H
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFG.h"
+#include "DominatorSolver.h"
+#include "IdentityOptimizer.h"
+#include "RewriteRules.h"
+
+// Reassociates chains of + * & | ^ within a block so value numbering
+// sees them in one canonical form, (a + b) + c and (a + c) + b both
+// become the same thing. A chain is an operation and the operations of
+// the same op it reads that nobody else reads, flattened to its leaves.
+// The leaves are ranked (values from other blocks first, then in the
+// order the block defines them), the constants are folded into one at
+// the end, and the chain is rebuilt left to right with the registers
+// of the operations it swallowed. A leaf with a constant of its own,
+// like x + 1 read twice, is opened up too when the chain already has a
+// constant, so ((x + 1) + 2) is x + 3 either way.
+// Expects SSA form, so each register has a single definition.
+class ReassociationOptimizer : public IdentityOptimizer
+{
+   private:
+      // Register to the number of statements reading it in the method
+      std::map<std::string, unsigned long> _uses;
+      // Operations to how often the method computes them, with operands in order
+      std::map<std::pair<char, std::pair<std::string, std::string>>, unsigned long> _exprs;
+      // Register to the arithmetic defining it in the current block, and its position
+      std::map<std::string, ArithmeticPrimitive*> _defs;
+      std::map<std::string, unsigned long> _rank;
+      // Roots to what replaces them, and the operations chains swallowed
+      std::map<ArithmeticPrimitive*, std::vector<std::shared_ptr<PrimitiveStatement>>> _rewrite;
+      std::set<ArithmeticPrimitive*> _absorbed;
+      static std::pair<char, std::pair<std::string, std::string>> expr(ArithmeticPrimitive * ap) {
+         std::string op1 = ap->op1();
+         std::string op2 = ap->op2();
+         return std::make_pair(ap->op(), op1 < op2 ? std::make_pair(op1, op2) : std::make_pair(op2, op1));
+      }
+      // Arithmetic uses 64 bit wraparound, same as the interpreter
+      static unsigned long long identity(char op) {
+         if (op == '*') {
+            return 1;
+         } else if (op == '&') {
+            return ~0ULL;
+         }
+         return 0;
+      }
+      // Folded constant that makes the whole chain that constant
+      static bool absorbing(char op, unsigned long long c) {
+         return (op == '*' && c == 0) || (op == '&' && c == 0) || (op == '|' && c == ~0ULL);
+      }
+      void flatten(std::string reg, char op, std::vector<std::string> & leaves, std::vector<std::string> & names) {
+         ArithmeticPrimitive * def = _defs.count(reg) ? _defs[reg] : nullptr;
+         // Something computed twice is left alone for VN to share
+         if (def == nullptr || def->op() != op || _uses[reg] != 1 || _exprs[expr(def)] > 1) {
+            leaves.push_back(reg);
+            return;
+         }
+         _absorbed.insert(def);
+         names.push_back(reg);
+         flatten(def->op1(), op, leaves, names);
+         flatten(def->op2(), op, leaves, names);
+      }
+      // Opens up leaves that are another register op a constant
+      void openConstants(char op, std::vector<std::string> & leaves) {
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            for (auto & l : leaves) {
+               ArithmeticPrimitive * def = _defs.count(l) ? _defs[l] : nullptr;
+               if (def == nullptr || def->op() != op || isNumber(def->op1()) == isNumber(def->op2())) {
+                  continue;
+               }
+               std::string c = isNumber(def->op1()) ? def->op1() : def->op2();
+               std::string reg = isNumber(def->op1()) ? def->op2() : def->op1();
+               // Its own chain may reuse that register for something else
+               if (_defs.count(reg) && _defs[reg]->op() == op && _uses[reg] == 1 && _exprs[expr(_defs[reg])] == 1) {
+                  continue;
+               }
+               l = reg;
+               leaves.push_back(c);
+               changed = true;
+               break;
+            }
+         }
+      }
+      bool ranked(const std::string & a, const std::string & b) {
+         unsigned long ra = _rank.count(a) ? _rank[a] : 0;
+         unsigned long rb = _rank.count(b) ? _rank[b] : 0;
+         return ra != rb ? ra < rb : a < b;
+      }
+      void reassociate(ArithmeticPrimitive * root) {
+         char op = root->op();
+         std::vector<std::string> leaves;
+         std::vector<std::string> names;
+         flatten(root->op1(), op, leaves, names);
+         flatten(root->op2(), op, leaves, names);
+         unsigned long long c = identity(op);
+         bool constant = false;
+         for (const auto & l : leaves) {
+            constant = constant || isNumber(l);
+         }
+         if (constant) {
+            openConstants(op, leaves);
+         }
+         if (leaves.size() <= 2) {
+            return;
+         }
+         std::vector<std::string> regs;
+         for (const auto & l : leaves) {
+            if (isNumber(l)) {
+               RewriteRules::fold(op, c, std::stoull(l), c);
+            } else {
+               regs.push_back(l);
+            }
+         }
+         std::sort(regs.begin(), regs.end(), [this](const std::string & a, const std::string & b) { return ranked(a, b); });
+         // x & x and x | x are x, x ^ x is nothing
+         if (op == '&' || op == '|') {
+            regs.erase(std::unique(regs.begin(), regs.end()), regs.end());
+         } else if (op == '^') {
+            std::vector<std::string> odd;
+            for (const auto & r : regs) {
+               if (!odd.empty() && odd.back() == r) {
+                  odd.pop_back();
+               } else {
+                  odd.push_back(r);
+               }
+            }
+            regs = odd;
+         }
+         if (absorbing(op, c)) {
+            regs.clear();
+         }
+         if (c != identity(op) || regs.empty()) {
+            regs.push_back(std::to_string(c));
+         }
+         std::vector<std::shared_ptr<PrimitiveStatement>> chain;
+         std::string acc = regs[0];
+         for (unsigned long i=1; i<regs.size(); i++) {
+            std::string lhs = i + 1 == regs.size() ? root->lhs() : names[i - 1];
+            chain.push_back(std::make_shared<ArithmeticPrimitive>(lhs, acc, op, regs[i]));
+            acc = lhs;
+         }
+         if (regs.size() == 1) {
+            chain.push_back(std::make_shared<AssignmentPrimitive>(root->lhs(), acc));
+         }
+         _rewrite[root] = chain;
+      }
+   public:
+      void visit(ArithmeticPrimitive& node) {
+         if (_absorbed.find(&node) != _absorbed.end()) {
+            return;
+         }
+         if (_rewrite.find(&node) == _rewrite.end()) {
+            IdentityOptimizer::visit(node);
+            return;
+         }
+         for (auto & p : _rewrite[&node]) {
+            _new_block->appendPrimitive(p);
+         }
+      }
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         _uses.clear();
+         _exprs.clear();
+         _rewrite.clear();
+         _absorbed.clear();
+         for (const auto & kv : blockmap) {
+            for (const auto & p : kv.second->primitives()) {
+               for (const auto & r : p->RHS()) {
+                  _uses[r]++;
+               }
+               ArithmeticPrimitive * ap = dynamic_cast<ArithmeticPrimitive*>(p.get());
+               if (ap != nullptr && RewriteRules::commutative(ap->op())) {
+                  _exprs[expr(ap)]++;
+               }
+            }
+            for (const auto & r : kv.second->control()->RHS()) {
+               _uses[r]++;
+            }
+         }
+         for (const auto & kv : blockmap) {
+            _defs.clear();
+            _rank.clear();
+            std::vector<ArithmeticPrimitive*> arithmetic;
+            std::vector<std::shared_ptr<PrimitiveStatement>> primitives = kv.second->primitives();
+            for (unsigned long i=0; i<primitives.size(); i++) {
+               for (const auto & d : primitives[i]->LHS()) {
+                  _rank[d] = i + 1;
+               }
+               ArithmeticPrimitive * ap = dynamic_cast<ArithmeticPrimitive*>(primitives[i].get());
+               if (ap != nullptr && RewriteRules::commutative(ap->op())) {
+                  _defs[ap->lhs()] = ap;
+                  arithmetic.push_back(ap);
+               }
+            }
+            // Last first, so a chain's root is seen before the rest of it
+            for (auto it = arithmetic.rbegin(); it != arithmetic.rend(); it++) {
+               if (_absorbed.find(*it) == _absorbed.end()) {
+                  reassociate(*it);
+               }
+            }
+         }
+         IdentityOptimizer::visit(node);
+      }
+};
+
+#endif
@@ -0,0 +1,409 @@
+#ifndef _CS_441_REGISTER_ALLOCATOR_H
+#define _CS_441_REGISTER_ALLOCATOR_H
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFG.h"
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "LivenessSolver.h"
+#include "RenamingOptimizer.h"
+
+// Linear scan register allocation (Poletto and Sarkar) to a fixed
+// number of registers %r0 .. %r(K-1). Expects code out of SSA form.
+// Values that do not fit are spilled to a frame object allocated at
+// method entry: every use reloads with getelt, every def stores with
+// setelt, and allocation is repeated until nothing else spills.
+// If a single statement needs more than K registers at once, or more
+// pointers spill than the frame's GC bitfield has bits for, the budget
+// for that method is raised until it fits, with a note on stderr.
+class RegisterAllocator : public RenamingOptimizer
+{
+   private:
+      struct Interval {
+         std::string reg;
+         unsigned long start;
+         unsigned long end;
+      };
+      unsigned long _budget;
+      unsigned long _next_temp;
+      bool _final;
+      std::set<std::string> _classes;
+      std::map<std::string, std::string> _var_to_type;
+      // Register to register, for spill rewrites and the final renaming
+      std::map<std::string, std::string> _mapping;
+      // Reload and store temporaries (and the frame) cannot spill again
+      std::set<std::string> _unspillable;
+      // Spilled register to spill slot id, and whether that slot holds a pointer
+      std::map<std::string, unsigned long> _spill_slot;
+      std::vector<bool> _slot_is_pointer;
+      // Register holding the frame
+      std::string _frame;
+      // Number of statements at the top of the entry block setting up the frame
+      unsigned long _prologue;
+      bool isVector(std::string reg) {
+         return reg.rfind(toRegister(VECTOR), 0) == 0;
+      }
+      bool isPointer(std::string reg) {
+         return _var_to_type.find(reg) != _var_to_type.end() && _classes.find(_var_to_type[reg]) != _classes.end();
+      }
+      std::string newTemporary() {
+         std::string reg = toRegister(std::to_string(_next_temp++));
+         _unspillable.insert(reg);
+         return reg;
+      }
+      // Pointer slots come first so they fit in the GC bitfield
+      std::string slotIndex(std::string id) {
+         unsigned long slot = std::stoul(id);
+         unsigned long index = 1;
+         for (unsigned long i=0; i<_slot_is_pointer.size(); i++) {
+            if (i != slot && (_slot_is_pointer[i] > _slot_is_pointer[slot] ||
+                     (_slot_is_pointer[i] == _slot_is_pointer[slot] && i < slot))) {
+               index++;
+            }
+         }
+         return std::to_string(index);
+      }
+      // Pointer slots are 1 .. 63, visit(MethodCFG&) raises k until they fit
+      std::string bitfield() {
+         uint64_t bits = 0;
+         for (unsigned long i=0; i<_slot_is_pointer.size(); i++) {
+            unsigned long index = std::stoul(slotIndex(std::to_string(i)));
+            if (_slot_is_pointer[i]) {
+               bits |= ((uint64_t) 1 << index);
+            }
+         }
+         return std::to_string(bits);
+      }
+      std::vector<std::shared_ptr<BasicBlock>> copyBlocks(std::vector<std::shared_ptr<BasicBlock>> blocks) {
+         std::vector<std::shared_ptr<BasicBlock>> copies;
+         for (const auto & b : blocks) {
+            std::shared_ptr<BasicBlock> copy = std::make_shared<BasicBlock>(b->label(), b->params());
+            for (const auto & p : b->primitives()) {
+               copy->appendPrimitive(p);
+            }
+            copy->setControl(b->control());
+            copies.push_back(copy);
+         }
+         return copies;
+      }
+      // Allocate registers to the blocks (in emission order) with k registers
+      // Fills spills with registers to spill, false if nothing can be spilled
+      bool scan(std::vector<std::shared_ptr<BasicBlock>> & blocks, unsigned long k, std::set<std::string> & spills) {
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap;
+         for (const auto & b : blocks) {
+            blockmap[b->label()] = b;
+         }
+         LivenessSolver ls;
+         ls.solve(blockmap);
+         // Uses of statement i are at 2i and defs at 2i+1, so a register
+         // read for the last time can be reused by the result
+         std::map<std::string, Interval> intervals;
+         auto touch = [&] (std::string reg, unsigned long pos) {
+            if (isVector(reg)) {
+               return;
+            }
+            if (intervals.find(reg) == intervals.end()) {
+               intervals[reg] = Interval{reg, pos, pos};
+            }
+            intervals[reg].start = std::min(intervals[reg].start, pos);
+            intervals[reg].end = std::max(intervals[reg].end, pos);
+         };
+         unsigned long i = 0;
+         for (const auto & b : blocks) {
+            unsigned long start = 2 * i;
+            for (const auto & p : b->params()) {
+               touch(p, start);
+            }
+            for (const auto & r : ls.liveIn(b->label())) {
+               touch(r, start);
+            }
+            for (const auto & p : b->primitives()) {
+               for (const auto & u : LivenessSolver::uses(p)) {
+                  touch(u, 2 * i);
+               }
+               for (const auto & d : LivenessSolver::defs(p)) {
+                  touch(d, 2 * i + 1);
+               }
+               i++;
+            }
+            for (const auto & u : LivenessSolver::uses(b->control())) {
+               touch(u, 2 * i);
+            }
+            i++;
+            for (const auto & r : ls.liveOut(b->label())) {
+               touch(r, 2 * i - 1);
+            }
+         }
+         std::vector<Interval> sorted;
+         for (const auto & kv : intervals) {
+            sorted.push_back(kv.second);
+         }
+         std::stable_sort(sorted.begin(), sorted.end(), [] (const Interval & a, const Interval & b) {
+            return a.start < b.start;
+         });
+         std::map<std::string, unsigned long> assignment;
+         std::vector<Interval> active;
+         std::set<unsigned long> free;
+         for (unsigned long r=0; r<k; r++) {
+            free.insert(r);
+         }
+         auto activate = [&] (Interval interval) {
+            auto pos = std::upper_bound(active.begin(), active.end(), interval, [] (const Interval & a, const Interval & b) {
+               return a.end < b.end;
+            });
+            active.insert(pos, interval);
+         };
+         for (const auto & curr : sorted) {
+            // Expire intervals that ended before this one starts
+            while (active.size() > 0 && active.front().end < curr.start) {
+               free.insert(assignment[active.front().reg]);
+               active.erase(active.begin());
+            }
+            if (free.size() > 0) {
+               assignment[curr.reg] = *free.begin();
+               free.erase(free.begin());
+               activate(curr);
+               continue;
+            }
+            // Spill whichever spillable interval ends last
+            auto victim = active.end();
+            for (auto it = active.rbegin(); it != active.rend(); it++) {
+               if (_unspillable.find(it->reg) == _unspillable.end()) {
+                  victim = std::prev(it.base());
+                  break;
+               }
+            }
+            bool curr_spillable = _unspillable.find(curr.reg) == _unspillable.end();
+            if (curr_spillable && (victim == active.end() || curr.end >= victim->end)) {
+               spills.insert(curr.reg);
+               continue;
+            }
+            if (victim == active.end()) {
+               return false;
+            }
+            assignment[curr.reg] = assignment[victim->reg];
+            spills.insert(victim->reg);
+            active.erase(victim);
+            activate(curr);
+         }
+         _mapping.clear();
+         for (const auto & kv : assignment) {
+            _mapping[kv.first] = toRegister("r" + std::to_string(kv.second));
+         }
+         return true;
+      }
+      // Spilled parameters are stored to the frame right after it is set up
+      void appendStores(std::vector<std::pair<std::string, std::string>> & param_stores,
+            std::function<std::string(std::string)> slot) {
+         for (const auto & ps : param_stores) {
+            _new_block->appendPrimitive(std::make_shared<SetEltPrimitive>(_frame, slot(ps.first), ps.second));
+            _prologue++;
+         }
+         param_stores.clear();
+      }
+      // Rewrite every use of a spilled register to a reload, and every def to a store
+      void rewrite(std::vector<std::shared_ptr<BasicBlock>> & blocks, std::set<std::string> & spills) {
+         if (_frame == "") {
+            // Sizes are filled in by the final renaming, once all spills are known
+            _frame = newTemporary();
+            std::shared_ptr<BasicBlock> entry = blocks[0];
+            std::shared_ptr<BasicBlock> block = std::make_shared<BasicBlock>(entry->label(), entry->params());
+            block->appendPrimitive(std::make_shared<AllocPrimitive>(_frame, "0"));
+            // Step the frame back to slot -1 for the bitfield, no extra register needed
+            block->appendPrimitive(std::make_shared<ArithmeticPrimitive>(_frame, _frame, '-', std::to_string(8)));
+            block->appendPrimitive(std::make_shared<StorePrimitive>(_frame, "0"));
+            block->appendPrimitive(std::make_shared<ArithmeticPrimitive>(_frame, _frame, '+', std::to_string(8)));
+            for (const auto & p : entry->primitives()) {
+               block->appendPrimitive(p);
+            }
+            block->setControl(entry->control());
+            blocks[0] = block;
+            _prologue = 4;
+         }
+         for (const auto & s : spills) {
+            _spill_slot[s] = _slot_is_pointer.size();
+            _slot_is_pointer.push_back(isPointer(s));
+         }
+         auto slot = [&] (std::string reg) {
+            return std::to_string(_spill_slot[reg]);
+         };
+         for (unsigned long bi=0; bi<blocks.size(); bi++) {
+            std::shared_ptr<BasicBlock> b = blocks[bi];
+            std::vector<std::string> params = b->params();
+            std::vector<std::pair<std::string, std::string>> param_stores;
+            for (auto & p : params) {
+               if (spills.find(p) != spills.end()) {
+                  std::string t = newTemporary();
+                  param_stores.push_back(std::make_pair(p, t));
+                  p = t;
+               }
+            }
+            _new_block = std::make_shared<BasicBlock>(b->label(), params);
+            std::vector<std::shared_ptr<PrimitiveStatement>> primitives = b->primitives();
+            for (unsigned long i=0; i<primitives.size(); i++) {
+               std::shared_ptr<PrimitiveStatement> p = primitives[i];
+               if (i == _prologue) {
+                  appendStores(param_stores, slot);
+               }
+               std::vector<std::string> spilled_uses;
+               std::vector<std::string> spilled_defs;
+               for (const auto & u : LivenessSolver::uses(p)) {
+                  if (spills.find(u) != spills.end() && std::find(spilled_uses.begin(), spilled_uses.end(), u) == spilled_uses.end()) {
+                     spilled_uses.push_back(u);
+                  }
+               }
+               for (const auto & d : LivenessSolver::defs(p)) {
+                  if (spills.find(d) != spills.end() && std::find(spilled_defs.begin(), spilled_defs.end(), d) == spilled_defs.end()) {
+                     spilled_defs.push_back(d);
+                  }
+               }
+               AssignmentPrimitive * a = dynamic_cast<AssignmentPrimitive*>(p.get());
+               if (a != nullptr && spilled_uses.size() + spilled_defs.size() == 1) {
+                  // Copies to or from a spilled register load or store directly
+                  if (spilled_uses.size() == 1) {
+                     _new_block->appendPrimitive(std::make_shared<GetEltPrimitive>(a->lhs(), _frame, slot(a->rhs())));
+                  } else {
+                     _new_block->appendPrimitive(std::make_shared<SetEltPrimitive>(_frame, slot(a->lhs()), a->rhs()));
+                  }
+                  continue;
+               }
+               _mapping.clear();
+               for (const auto & u : spilled_uses) {
+                  _mapping[u] = newTemporary();
+                  _new_block->appendPrimitive(std::make_shared<GetEltPrimitive>(_mapping[u], _frame, slot(u)));
+               }
+               for (const auto & d : spilled_defs) {
+                  if (_mapping.find(d) == _mapping.end()) {
+                     _mapping[d] = newTemporary();
+                  }
+               }
+               p->accept(*this);
+               for (const auto & d : spilled_defs) {
+                  _new_block->appendPrimitive(std::make_shared<SetEltPrimitive>(_frame, slot(d), _mapping[d]));
+               }
+            }
+            if (_prologue == primitives.size()) {
+               appendStores(param_stores, slot);
+            }
+            _mapping.clear();
+            for (const auto & u : LivenessSolver::uses(b->control())) {
+               if (spills.find(u) != spills.end() && _mapping.find(u) == _mapping.end()) {
+                  _mapping[u] = newTemporary();
+                  _new_block->appendPrimitive(std::make_shared<GetEltPrimitive>(_mapping[u], _frame, slot(u)));
+               }
+            }
+            b->control()->accept(*this);
+            blocks[bi] = _new_block;
+         }
+      }
+   protected:
+      std::string rename(std::string reg) {
+         return _mapping.find(reg) != _mapping.end() ? _mapping[reg] : reg;
+      }
+   public:
+      RegisterAllocator(unsigned long budget) : _budget(budget), _final(false) {}
+      void visit(AllocPrimitive& node) {
+         if (_final && node.lhs() == _frame) {
+            // One slot per spilled register after the vtable slot
+            _new_block->appendPrimitive(std::make_shared<AllocPrimitive>(rename(node.lhs()),
+                     std::to_string(_slot_is_pointer.size() + 1)));
+            return;
+         }
+         RenamingOptimizer::visit(node);
+      }
+      void visit(StorePrimitive& node) {
+         if (_final && node.addr() == _frame) {
+            _new_block->appendPrimitive(std::make_shared<StorePrimitive>(rename(node.addr()), bitfield()));
+            return;
+         }
+         RenamingOptimizer::visit(node);
+      }
+      void visit(GetEltPrimitive& node) {
+         if (_final && node.arr() == _frame) {
+            _new_block->appendPrimitive(std::make_shared<GetEltPrimitive>(rename(node.lhs()), rename(node.arr()), slotIndex(node.index())));
+            return;
+         }
+         RenamingOptimizer::visit(node);
+      }
+      void visit(SetEltPrimitive& node) {
+         if (_final && node.arr() == _frame) {
+            _new_block->appendPrimitive(std::make_shared<SetEltPrimitive>(rename(node.arr()), slotIndex(node.index()), rename(node.val())));
+            return;
+         }
+         RenamingOptimizer::visit(node);
+      }
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::shared_ptr<BasicBlock>> original;
+         for (const auto & label : linker.order(method)) {
+            original.push_back(blockmap[label]);
+         }
+         _var_to_type = node.var_to_type();
+         std::vector<std::shared_ptr<BasicBlock>> blocks;
+         unsigned long k = _budget;
+         while (true) {
+            _next_temp = CFGLinker::nextTemporary(blockmap);
+            _unspillable.clear();
+            _spill_slot.clear();
+            _slot_is_pointer.clear();
+            _frame = "";
+            _prologue = 0;
+            blocks = copyBlocks(original);
+            bool fits = true;
+            while (true) {
+               std::set<std::string> spills;
+               if (!scan(blocks, k, spills)) {
+                  fits = false;
+                  break;
+               }
+               if (spills.size() == 0) {
+                  break;
+               }
+               rewrite(blocks, spills);
+            }
+            // Slot 0 of the bitfield is the vtable slot
+            if (fits && std::count(_slot_is_pointer.begin(), _slot_is_pointer.end(), true) < 64) {
+               break;
+            }
+            k++;
+         }
+         if (k > _budget) {
+            std::cerr << "Register allocation: " << original[0]->label() << " needs " << k
+               << " registers, more than -regalloc=" << _budget << std::endl;
+         }
+         // Rename everything to the allocated registers
+         _final = true;
+         std::vector<std::shared_ptr<BasicBlock>> allocated;
+         for (const auto & b : blocks) {
+            std::vector<std::string> params;
+            for (const auto & p : b->params()) {
+               params.push_back(rename(p));
+            }
+            _new_block = std::make_shared<BasicBlock>(b->label(), params);
+            for (auto & p : b->primitives()) {
+               p->accept(*this);
+            }
+            b->control()->accept(*this);
+            allocated.push_back(_new_block);
+         }
+         _final = false;
+         _new_method = linker.link(allocated, node.variables(), node.var_to_type());
+      }
+      void visit(ProgramCFG& node) {
+         _classes.clear();
+         for (const auto & kv : node.classes()) {
+            _classes.insert(kv.first);
+         }
+         IdentityOptimizer::visit(node);
+      }
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef _CS_441_RENAMING_OPTIMIZER_H
+#define _CS_441_RENAMING_OPTIMIZER_H
+#include "CFG.h"
+#include "IdentityOptimizer.h"
+
+// Rebuild every statement with its registers passed through rename()
+// and its branch labels passed through retarget()
+// Intent is to inherit in passes that rename registers (out of SSA,
+// register allocation) so they only need to supply the mapping
+class RenamingOptimizer : public IdentityOptimizer
+{
+   protected:
+      virtual std::string rename(std::string reg) {
+         return reg;
+      }
+      virtual std::string retarget(std::string label) {
+         return label;
+      }
+   public:
+      // Comment doesn't need adjustment
+      void visit(AssignmentPrimitive& node) {
+         std::string lhs = rename(node.lhs());
+         std::string rhs = rename(node.rhs());
+         // Moves between registers that got the same name are dropped
+         if (lhs != rhs) {
+            _new_block->appendPrimitive(std::make_shared<AssignmentPrimitive>(lhs, rhs));
+         }
+      }
+      void visit(ArithmeticPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<ArithmeticPrimitive>(
+                  rename(node.lhs()),
+                  rename(node.op1()),
+                  node.op(),
+                  rename(node.op2())));
+      }
+      void visit(CallPrimitive& node) {
+         std::vector<std::string> args;
+         for (const auto & a : node.args()) {
+            args.push_back(rename(a));
+         }
+         _new_block->appendPrimitive(std::make_shared<CallPrimitive>(
+                  rename(node.lhs()),
+                  rename(node.codeaddr()),
+                  rename(node.receiver()),
+                  args));
+      }
+      void visit(PhiPrimitive& node) {
+         std::vector<std::pair<std::string, std::string>> args;
+         for (const auto & a : node.args()) {
+            args.push_back(std::make_pair(a.first, rename(a.second)));
+         }
+         _new_block->appendPrimitive(std::make_shared<PhiPrimitive>(rename(node.lhs()), args));
+      }
+      void visit(AllocPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<AllocPrimitive>(rename(node.lhs()), rename(node.size())));
+      }
+      void visit(PrintPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<PrintPrimitive>(rename(node.val())));
+      }
+      void visit(GetEltPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<GetEltPrimitive>(rename(node.lhs()), rename(node.arr()), rename(node.index())));
+      }
+      void visit(SetEltPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<SetEltPrimitive>(rename(node.arr()), rename(node.index()), rename(node.val())));
+      }
+      void visit(LoadPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<LoadPrimitive>(rename(node.lhs()), rename(node.addr())));
+      }
+      void visit(StorePrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<StorePrimitive>(rename(node.addr()), rename(node.val())));
+      }
+      void visit(LoadVectorPrimitive& node) {
+         std::vector<std::string> vals;
+         for (const auto & v : node.vals()) {
+            vals.push_back(rename(v));
+         }
+         _new_block->appendPrimitive(std::make_shared<LoadVectorPrimitive>(rename(node.lhs()), vals));
+      }
+      void visit(StoreVectorPrimitive& node) {
+         std::vector<std::string> vals;
+         for (const auto & v : node.vals()) {
+            vals.push_back(rename(v));
+         }
+         _new_block->appendPrimitive(std::make_shared<StoreVectorPrimitive>(vals, rename(node.rhs())));
+      }
+      void visit(AddVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<AddVectorPrimitive>(rename(node.lhs()), rename(node.op1()), rename(node.op2())));
+      }
+      void visit(SubtractVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<SubtractVectorPrimitive>(rename(node.lhs()), rename(node.op1()), rename(node.op2())));
+      }
+      void visit(MultiplyVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<MultiplyVectorPrimitive>(rename(node.lhs()), rename(node.op1()), rename(node.op2())));
+      }
+      void visit(DivideVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<DivideVectorPrimitive>(rename(node.lhs()), rename(node.op1()), rename(node.op2())));
+      }
+      void visit(ReduceVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<ReduceVectorPrimitive>(rename(node.lhs()), node.op(), rename(node.rhs())));
+      }
+      void visit(GetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<GetEltVectorPrimitive>(rename(node.lhs()), rename(node.arr()), rename(node.index()), node.width()));
+      }
+      void visit(SetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<SetEltVectorPrimitive>(rename(node.arr()), rename(node.index()), rename(node.val())));
+      }
+      void visit(ShuffleVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<ShuffleVectorPrimitive>(rename(node.lhs()), rename(node.rhs()), node.indices()));
+      }
+      // FailControl doesn't need adjustment
+      void visit(JumpControl& node) {
+         _new_block->setControl(std::make_shared<JumpControl>(retarget(node.branch())));
+      }
+      void visit(IfElseControl& node) {
+         _new_block->setControl(std::make_shared<IfElseControl>(
+                  rename(node.cond()),
+                  retarget(node.if_branch()),
+                  retarget(node.else_branch())));
+      }
+      void visit(RetControl& node) {
+         _new_block->setControl(std::make_shared<RetControl>(rename(node.val())));
+      }
+      void visit(TailCallControl& node) {
+         std::vector<std::string> args;
+         for (const auto & a : node.args()) {
+            args.push_back(rename(a));
+         }
+         _new_block->setControl(std::make_shared<TailCallControl>(rename(node.codeaddr()), rename(node.receiver()), args));
+      }
+};
+
+#endif
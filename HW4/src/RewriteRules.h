@@ -0,0 +1,166 @@
+#ifndef _CS_441_REWRITE_RULES_H
+#define _CS_441_REWRITE_RULES_H
+#include <array>
+#include <string>
+#include "CFG.h"
+
+// Algebraic identities for a single arithmetic operation, shared by the
+// peephole pass and value numbering so both fold the same way.
+// The rules are a table, sorted by op and indexed when this compiles,
+// so matching an operation only looks at the rules for its op.
+// Arithmetic is on 64 bit unsigned values that wrap around, like the
+// interpreter, and division by zero is left for the program to fail on.
+// A rule operand is either whatever the operation has there, or a
+// constant. A rule with the register on both sides only matches when
+// both operands are the same.
+struct RewriteTerm
+{
+   enum Kind { REG, CONST };
+   Kind kind;
+   unsigned long long value;
+};
+
+constexpr RewriteTerm rewriteConst(unsigned long long value) {
+   return { RewriteTerm::CONST, value };
+}
+
+// op lhs rhs becomes out_op out1 out2, '=' is a copy of out1
+struct RewriteRule
+{
+   char op;
+   RewriteTerm lhs;
+   RewriteTerm rhs;
+   char out_op;
+   RewriteTerm out1;
+   RewriteTerm out2;
+};
+
+// The rules sorted by op, with the first and one past the last rule
+// for each op
+template <unsigned long N>
+struct RewriteIndex
+{
+   std::array<unsigned long, 128> begin = {};
+   std::array<unsigned long, 128> end = {};
+   std::array<RewriteRule, N> rules = {};
+   constexpr RewriteIndex(const RewriteRule (&table)[N]) {
+      unsigned long n = 0;
+      for (unsigned long op=0; op<128; op++) {
+         begin[op] = n;
+         for (unsigned long i=0; i<N; i++) {
+            if ((unsigned long) table[i].op == op) {
+               rules[n++] = table[i];
+            }
+         }
+         end[op] = n;
+      }
+   }
+};
+
+class RewriteRules
+{
+   public:
+      // Op and operands after rewriting, '=' is a copy of op1
+      struct Result {
+         char op;
+         std::string op1;
+         std::string op2;
+      };
+   private:
+      static constexpr unsigned long long ONES = ~0ULL;
+      static constexpr RewriteTerm x = { RewriteTerm::REG, 0 };
+      // Commutative ops are tried with the operands both ways round
+      static constexpr RewriteRule RULES[] = {
+         { '+', x, rewriteConst(0), '=', x, x },
+         { '-', x, rewriteConst(0), '=', x, x },
+         { '-', x, x, '=', rewriteConst(0), x },
+         { '*', x, rewriteConst(0), '=', rewriteConst(0), x },
+         { '*', x, rewriteConst(1), '=', x, x },
+         { '*', x, rewriteConst(2), '+', x, x },
+         { '/', x, rewriteConst(1), '=', x, x },
+         { '&', x, rewriteConst(0), '=', rewriteConst(0), x },
+         { '&', x, rewriteConst(ONES), '=', x, x },
+         { '&', x, x, '=', x, x },
+         { '|', x, rewriteConst(0), '=', x, x },
+         { '|', x, rewriteConst(ONES), '=', rewriteConst(ONES), x },
+         { '|', x, x, '=', x, x },
+         { '^', x, rewriteConst(0), '=', x, x },
+         { '^', x, x, '=', rewriteConst(0), x },
+      };
+      static constexpr RewriteIndex<sizeof(RULES) / sizeof(RewriteRule)> INDEX = RULES;
+      static bool matches(RewriteTerm t, const std::string & operand) {
+         return t.kind == RewriteTerm::REG || (isNumber(operand) && std::stoull(operand) == t.value);
+      }
+      static std::string emit(RewriteTerm t, const std::string & reg) {
+         return t.kind == RewriteTerm::REG ? reg : std::to_string(t.value);
+      }
+      static bool match(const RewriteRule & rule, const std::string & op1, const std::string & op2, Result & result) {
+         // The register is whatever the first REG term matched
+         std::string reg = rule.lhs.kind == RewriteTerm::REG ? op1 : op2;
+         if (rule.lhs.kind == RewriteTerm::REG && rule.rhs.kind == RewriteTerm::REG && op1 != op2) {
+            return false;
+         }
+         if (!matches(rule.lhs, op1) || !matches(rule.rhs, op2)) {
+            return false;
+         }
+         result = { rule.out_op, emit(rule.out1, reg), emit(rule.out2, reg) };
+         return true;
+      }
+   public:
+      static constexpr bool commutative(char op) {
+         return op == '+' || op == '*' || op == '&' || op == '|' || op == '^';
+      }
+      // False when there is nothing to fold to (division by zero)
+      static bool fold(char op, unsigned long long a, unsigned long long b, unsigned long long & result) {
+         if (op == '+') {
+            result = a + b;
+         } else if (op == '-') {
+            result = a - b;
+         } else if (op == '*') {
+            result = a * b;
+         } else if (op == '/') {
+            if (b == 0) {
+               return false;
+            }
+            result = a / b;
+         } else if (op == '&') {
+            result = a & b;
+         } else if (op == '|') {
+            result = a | b;
+         } else if (op == '^') {
+            result = a ^ b;
+         } else {
+            return false;
+         }
+         return true;
+      }
+      // Folds constants and applies the first rule that matches until
+      // neither does anything
+      static Result simplify(char op, std::string op1, std::string op2) {
+         Result result = { op, op1, op2 };
+         bool changed = true;
+         while (changed && result.op != '=') {
+            changed = false;
+            unsigned long long value;
+            if (isNumber(result.op1) && isNumber(result.op2) &&
+                  fold(result.op, std::stoull(result.op1), std::stoull(result.op2), value)) {
+               return { '=', std::to_string(value), "" };
+            }
+            unsigned char key = (unsigned char) result.op;
+            for (unsigned long i=INDEX.begin[key & 127]; i<INDEX.end[key & 127] && !changed; i++) {
+               Result next;
+               if (match(INDEX.rules[i], result.op1, result.op2, next) ||
+                     (commutative(result.op) && match(INDEX.rules[i], result.op2, result.op1, next))) {
+                  result = next;
+                  changed = true;
+               }
+            }
+         }
+         if (result.op == '=') {
+            result.op2 = "";
+         }
+         return result;
+      }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef _CS_441_RULE_TABLE_H
+#define _CS_441_RULE_TABLE_H
+#include <cctype>
+#include <istream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "CFG.h"
+#include "RewriteRules.h"
+
+// Rewrites over more than one operation, for -rules=FILE. tools/superopt
+// finds these. One rule a line, blank lines and lines starting with #
+// are skipped:
+//    (+ (- x y) y) => x
+// A pattern is a variable (a name starting with a letter), a constant,
+// or (op pattern pattern). The same variable twice only matches the
+// same operand, and commutative ops match either way round. What
+// it turns into is a variable, a constant, or one op on those, so it
+// always fits in the statement it replaces.
+class RuleTable
+{
+   public:
+      // op is 'v' for a variable and 'c' for a constant, named by name
+      struct Pattern {
+         char op;
+         std::string name;
+         std::vector<Pattern> operands;
+      };
+      // Register to the op and operands defining it
+      typedef std::map<std::string, std::tuple<char, std::string, std::string>> Defs;
+   private:
+      std::vector<std::pair<Pattern, Pattern>> _rules;
+      static bool parse(std::stringstream & in, Pattern & p) {
+         std::string token;
+         if (!(in >> token)) {
+            return false;
+         }
+         if (token == "(") {
+            std::string op;
+            Pattern a, b;
+            if (!(in >> op) || op.length() != 1 || !parse(in, a) || !parse(in, b) || !(in >> token) || token != ")") {
+               return false;
+            }
+            p = { op[0], "", { a, b } };
+            return RewriteRules::commutative(op[0]) || op[0] == '-' || op[0] == '/';
+         }
+         if (isNumber(token)) {
+            p = { 'c', std::to_string(std::stoull(token)), {} };
+            return true;
+         }
+         p = { 'v', token, {} };
+         return std::isalpha(token[0]);
+      }
+      static bool match(const Pattern & p, const std::string & operand, const Defs & defs, std::map<std::string, std::string> & bindings) {
+         if (p.op == 'c') {
+            return isNumber(operand) && std::stoull(operand) == std::stoull(p.name);
+         } else if (p.op == 'v') {
+            auto b = bindings.find(p.name);
+            if (b != bindings.end()) {
+               return b->second == operand;
+            }
+            bindings[p.name] = operand;
+            return true;
+         }
+         auto d = defs.find(operand);
+         if (d == defs.end() || std::get<0>(d->second) != p.op) {
+            return false;
+         }
+         return matchOp(p, std::get<1>(d->second), std::get<2>(d->second), defs, bindings);
+      }
+      static bool matchOp(const Pattern & p, const std::string & op1, const std::string & op2, const Defs & defs, std::map<std::string, std::string> & bindings) {
+         std::map<std::string, std::string> tried = bindings;
+         if (match(p.operands[0], op1, defs, tried) && match(p.operands[1], op2, defs, tried)) {
+            bindings = tried;
+            return true;
+         }
+         tried = bindings;
+         if (RewriteRules::commutative(p.op) && match(p.operands[0], op2, defs, tried) && match(p.operands[1], op1, defs, tried)) {
+            bindings = tried;
+            return true;
+         }
+         return false;
+      }
+      static std::string operand(const Pattern & p, std::map<std::string, std::string> & bindings) {
+         return p.op == 'v' ? bindings[p.name] : p.name;
+      }
+   public:
+      static bool parse(const std::string & text, Pattern & p) {
+         // Parentheses are tokens of their own
+         std::string spaced;
+         for (const auto & ch : text) {
+            spaced += ch == '(' || ch == ')' ? std::string(" ") + ch + " " : std::string(1, ch);
+         }
+         std::stringstream in(spaced);
+         std::string rest;
+         return parse(in, p) && !(in >> rest);
+      }
+      static std::string toString(const Pattern & p) {
+         if (p.op == 'v' || p.op == 'c') {
+            return p.name;
+         }
+         return "(" + std::string(1, p.op) + " " + toString(p.operands[0]) + " " + toString(p.operands[1]) + ")";
+      }
+      // False if the rule can't be applied as one statement
+      bool add(Pattern from, Pattern to) {
+         if (from.op == 'v' || from.op == 'c') {
+            return false;
+         }
+         for (const auto & o : to.operands) {
+            if (o.op != 'v' && o.op != 'c') {
+               return false;
+            }
+         }
+         _rules.push_back(std::make_pair(from, to));
+         return true;
+      }
+      // False if a line is not a rule, what was read before it is kept
+      bool load(std::istream & in) {
+         std::string line;
+         while (std::getline(in, line)) {
+            std::stringstream fields(line);
+            std::string first;
+            if (!(fields >> first) || first[0] == '#') {
+               continue;
+            }
+            size_t arrow = line.find("=>");
+            Pattern from, to;
+            if (arrow == std::string::npos || !parse(line.substr(0, arrow), from) ||
+                  !parse(line.substr(arrow + 2), to) || !add(from, to)) {
+               return false;
+            }
+         }
+         return true;
+      }
+      bool empty() {
+         return _rules.empty();
+      }
+      std::vector<std::pair<Pattern, Pattern>> rules() {
+         return _rules;
+      }
+      // Rewrites op1 op op2 with the first rule that matches it, looking
+      // through defs for the operations its operands came from
+      bool apply(char op, std::string op1, std::string op2, const Defs & defs, RewriteRules::Result & result) {
+         for (const auto & rule : _rules) {
+            std::map<std::string, std::string> bindings;
+            if (rule.first.op != op || !matchOp(rule.first, op1, op2, defs, bindings)) {
+               continue;
+            }
+            const Pattern & to = rule.second;
+            if (to.op == 'v' || to.op == 'c') {
+               result = { '=', operand(to, bindings), "" };
+            } else {
+               result = { to.op, operand(to.operands[0], bindings), operand(to.operands[1], bindings) };
+            }
+            return true;
+         }
+         return false;
+      }
+};
+
+#endif
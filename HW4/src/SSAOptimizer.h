@@ -148,6 +148,23 @@ class SSAOptimizer : public IdentityOptimizer
       void visit(DivideVectorPrimitive& node) {
          _new_block->appendPrimitive(std::make_shared<DivideVectorPrimitive>(adjustLHSVariable(node.lhs()), adjustRHSVariable(node.op1()), adjustRHSVariable(node.op2())));
       }
+      void visit(ReduceVectorPrimitive& node) {
+         // RHS first, the vector is read before the result is written
+         std::string rhs = adjustRHSVariable(node.rhs());
+         _new_block->appendPrimitive(std::make_shared<ReduceVectorPrimitive>(adjustLHSVariable(node.lhs()), node.op(), rhs));
+      }
+      void visit(GetEltVectorPrimitive& node) {
+         std::string arr = adjustRHSVariable(node.arr());
+         std::string index = adjustRHSVariable(node.index());
+         _new_block->appendPrimitive(std::make_shared<GetEltVectorPrimitive>(adjustLHSVariable(node.lhs()), arr, index, node.width()));
+      }
+      void visit(SetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<SetEltVectorPrimitive>(adjustRHSVariable(node.arr()), adjustRHSVariable(node.index()), adjustRHSVariable(node.val())));
+      }
+      void visit(ShuffleVectorPrimitive& node) {
+         std::string rhs = adjustRHSVariable(node.rhs());
+         _new_block->appendPrimitive(std::make_shared<ShuffleVectorPrimitive>(adjustLHSVariable(node.lhs()), rhs, node.indices()));
+      }
 
       // FailControl doesn't need adjustment
       // JumpControl doesn't need adjustment
@@ -161,6 +178,15 @@ class SSAOptimizer : public IdentityOptimizer
          std::string val = adjustRHSVariable(node.val());
          _new_block->setControl(std::make_shared<RetControl>(val));
       }
+      void visit(TailCallControl& node) {
+         std::string codeaddr = adjustRHSVariable(node.codeaddr());
+         std::string receiver = adjustRHSVariable(node.receiver());
+         std::vector<std::string> args;
+         for (auto & a : node.args()) {
+            args.push_back(adjustRHSVariable(a));
+         }
+         _new_block->setControl(std::make_shared<TailCallControl>(codeaddr, receiver, args));
+      }
       void optimizeChildren(BasicBlock& node) {
          std::string label = node.label();
          std::vector<std::shared_ptr<BasicBlock>> children = node.children();
@@ -222,7 +248,9 @@ class SSAOptimizer : public IdentityOptimizer
                newParams.push_back(p);
             }
             block->set_params(newParams);
-            if (block->predecessors().size() > 1) {
+            // Nothing is read once a block fails
+            bool fails = dynamic_cast<FailControl*>(block->control().get()) != nullptr;
+            if (block->predecessors().size() > 1 && !fails) {
                for (auto & v : _label_to_method[label]->variables()) {
                   std::string reg = toRegister(v);
                   std::string lhs = reg + std::to_string(_label_to_pre_counters[label][reg]);
@@ -0,0 +1,222 @@
+#ifndef _CS_441_SUPERBLOCK_OPTIMIZER_H
+#define _CS_441_SUPERBLOCK_OPTIMIZER_H
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "IdentityOptimizer.h"
+
+// Forms superblocks out of the blocks null checks split up, so the
+// vectorizer can pack field accesses on both sides of a check.
+// A block ending in a branch whose other side only fails, followed by a
+// block nothing else jumps to, continues into it, and a run of these is
+// a superblock with the failing blocks as side exits. Whatever can wait
+// is sunk to the start of its last block, past the checks: arithmetic,
+// copies, getelts and setelts that nothing left behind reads or
+// overwrites. Once a check fails the program is over, so running them
+// later can only be told apart by prints, calls, allocations and
+// divisions, which stay put along with what they and the checks read.
+class SuperblockOptimizer : public IdentityOptimizer
+{
+   private:
+      std::map<std::string, std::shared_ptr<BasicBlock>> _blocks;
+      std::map<std::string, unsigned long> _preds;
+      // Block does nothing but fail
+      bool cold(std::string label) {
+         std::shared_ptr<BasicBlock> block = _blocks[label];
+         return block->primitives().empty() && dynamic_cast<FailControl*>(block->control().get()) != nullptr;
+      }
+      // Block the superblock continues into past the check ending this
+      // one, or "" if it ends here
+      std::string next(std::shared_ptr<BasicBlock> block) {
+         IfElseControl * ifelse = dynamic_cast<IfElseControl*>(block->control().get());
+         if (ifelse == nullptr || ifelse->if_branch() == ifelse->else_branch()) {
+            return "";
+         }
+         std::string next = cold(ifelse->else_branch()) ? ifelse->if_branch() : cold(ifelse->if_branch()) ? ifelse->else_branch() : "";
+         if (next == "" || _preds[next] != 1 || cold(next)) {
+            return "";
+         }
+         for (const auto & p : _blocks[next]->primitives()) {
+            if (dynamic_cast<PhiPrimitive*>(p.get()) != nullptr) {
+               return "";
+            }
+         }
+         return next;
+      }
+      bool sinkable(std::shared_ptr<PrimitiveStatement> p) {
+         ArithmeticPrimitive * a = dynamic_cast<ArithmeticPrimitive*>(p.get());
+         return (a != nullptr && a->op() != '/')
+            || dynamic_cast<AssignmentPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<GetEltPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<SetEltPrimitive*>(p.get()) != nullptr;
+      }
+      // Calls and allocations (through the collector) do both
+      bool readsMemory(std::shared_ptr<PrimitiveStatement> p) {
+         return dynamic_cast<GetEltPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<LoadPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<CallPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<AllocPrimitive*>(p.get()) != nullptr;
+      }
+      bool writesMemory(std::shared_ptr<PrimitiveStatement> p) {
+         return dynamic_cast<SetEltPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<StorePrimitive*>(p.get()) != nullptr
+            || dynamic_cast<CallPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<AllocPrimitive*>(p.get()) != nullptr;
+      }
+      // Statement p is a getelt or setelt at a constant slot
+      bool ref(std::shared_ptr<PrimitiveStatement> p, bool & getelt, std::string & arr, long & slot) {
+         GetEltPrimitive* ge = dynamic_cast<GetEltPrimitive*>(p.get());
+         SetEltPrimitive* se = dynamic_cast<SetEltPrimitive*>(p.get());
+         std::string index = ge != nullptr ? ge->index() : se != nullptr ? se->index() : "";
+         if (index.empty() || !isNumber(index)) {
+            return false;
+         }
+         getelt = ge != nullptr;
+         arr = ge != nullptr ? ge->arr() : se->arr();
+         slot = std::stol(index);
+         return true;
+      }
+      // Sinking only pays off for what the vectorizer can then pair up,
+      // anything else just stays live longer. That is field accesses with
+      // one a slot over in another block of the superblock, and whatever
+      // arithmetic is computed from them.
+      std::set<PrimitiveStatement*> wanted(const std::vector<std::string> & trace) {
+         std::map<std::tuple<bool, std::string, long>, std::set<unsigned long>> blocks_of;
+         for (unsigned long t=0; t<trace.size(); t++) {
+            for (const auto & p : _blocks[trace[t]]->primitives()) {
+               bool getelt;
+               std::string arr;
+               long slot;
+               if (ref(p, getelt, arr, slot)) {
+                  blocks_of[std::make_tuple(getelt, arr, slot)].insert(t);
+               }
+            }
+         }
+         std::set<PrimitiveStatement*> wanted;
+         std::set<std::string> from;
+         for (unsigned long t=0; t+1<trace.size(); t++) {
+            for (const auto & p : _blocks[trace[t]]->primitives()) {
+               bool getelt;
+               std::string arr;
+               long slot;
+               bool want = false;
+               if (ref(p, getelt, arr, slot)) {
+                  for (const auto & s : { slot - 1, slot + 1 }) {
+                     auto b = blocks_of.find(std::make_tuple(getelt, arr, s));
+                     want = want || (b != blocks_of.end() && (b->second.size() > 1 || b->second.find(t) == b->second.end()));
+                  }
+               } else if (dynamic_cast<ArithmeticPrimitive*>(p.get()) != nullptr) {
+                  for (const auto & r : p->RHS()) {
+                     want = want || from.find(r) != from.end();
+                  }
+               }
+               if (want) {
+                  wanted.insert(p.get());
+                  for (const auto & l : p->LHS()) {
+                     from.insert(l);
+                  }
+               }
+            }
+         }
+         return wanted;
+      }
+   public:
+      void visit(MethodCFG& node) {
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         _blocks = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         _preds.clear();
+         // The entry is entered from outside too
+         _preds[order[0]]++;
+         for (const auto & label : order) {
+            for (const auto & t : _blocks[label]->control()->targets()) {
+               _preds[t]++;
+            }
+         }
+         std::set<std::string> continued;
+         for (const auto & label : order) {
+            std::string n = next(_blocks[label]);
+            if (n != "") {
+               continued.insert(n);
+            }
+         }
+         // Statements each block keeps, and those sunk into it
+         std::map<std::string, std::vector<std::shared_ptr<PrimitiveStatement>>> kept;
+         std::map<std::string, std::vector<std::shared_ptr<PrimitiveStatement>>> sunk;
+         for (const auto & label : order) {
+            if (kept.find(label) == kept.end()) {
+               kept[label] = _blocks[label]->primitives();
+            }
+            if (continued.find(label) != continued.end() || next(_blocks[label]) == "") {
+               continue;
+            }
+            std::vector<std::string> trace = { label };
+            while (next(_blocks[trace.back()]) != "") {
+               trace.push_back(next(_blocks[trace.back()]));
+            }
+            // Walk back from the last check, what stays behind needs its
+            // registers and memory as they are at that point
+            std::set<PrimitiveStatement*> want = wanted(trace);
+            std::set<std::string> read;
+            std::set<std::string> written;
+            bool memory_read = false;
+            bool memory_written = false;
+            std::vector<std::vector<std::shared_ptr<PrimitiveStatement>>> stays(trace.size() - 1);
+            std::vector<std::vector<std::shared_ptr<PrimitiveStatement>>> sinks(trace.size() - 1);
+            for (unsigned long t=trace.size()-1; t-- > 0;) {
+               std::shared_ptr<BasicBlock> block = _blocks[trace[t]];
+               for (const auto & r : block->control()->RHS()) {
+                  read.insert(r);
+               }
+               std::vector<std::shared_ptr<PrimitiveStatement>> primitives = block->primitives();
+               for (auto p = primitives.rbegin(); p != primitives.rend(); p++) {
+                  bool stay = !sinkable(*p) || want.find(p->get()) == want.end() || (readsMemory(*p) && memory_written) || (writesMemory(*p) && (memory_read || memory_written));
+                  for (const auto & l : (*p)->LHS()) {
+                     stay = stay || read.find(l) != read.end() || written.find(l) != written.end();
+                  }
+                  for (const auto & r : (*p)->RHS()) {
+                     stay = stay || written.find(r) != written.end();
+                  }
+                  if (!stay) {
+                     sinks[t].push_back(*p);
+                     continue;
+                  }
+                  stays[t].push_back(*p);
+                  for (const auto & l : (*p)->LHS()) {
+                     written.insert(l);
+                  }
+                  for (const auto & r : (*p)->RHS()) {
+                     read.insert(r);
+                  }
+                  memory_read = memory_read || readsMemory(*p);
+                  memory_written = memory_written || writesMemory(*p);
+               }
+            }
+            for (unsigned long t=0; t+1<trace.size(); t++) {
+               kept[trace[t]] = std::vector<std::shared_ptr<PrimitiveStatement>>(stays[t].rbegin(), stays[t].rend());
+               sunk[trace.back()].insert(sunk[trace.back()].end(), sinks[t].rbegin(), sinks[t].rend());
+            }
+         }
+         std::vector<std::shared_ptr<BasicBlock>> blocks;
+         for (const auto & label : order) {
+            std::shared_ptr<BasicBlock> new_block = std::make_shared<BasicBlock>(label, _blocks[label]->params());
+            for (const auto & p : sunk[label]) {
+               new_block->appendPrimitive(p);
+            }
+            for (const auto & p : kept[label]) {
+               new_block->appendPrimitive(p);
+            }
+            new_block->setControl(_blocks[label]->control());
+            blocks.push_back(new_block);
+         }
+         _new_method = linker.link(blocks, node.variables(), node.var_to_type());
+      }
+};
+
+#endif
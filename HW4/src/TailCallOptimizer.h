@@ -0,0 +1,215 @@
+#ifndef _CS_441_TAIL_CALL_OPTIMIZER_H
+#define _CS_441_TAIL_CALL_OPTIMIZER_H
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "CFG.h"
+#include "CFGLinker.h"
+#include "DominatorSolver.h"
+#include "IdentityOptimizer.h"
+
+// Eliminate tail calls, a call whose result is returned right away
+// Calls back into the same method become a jump to a loop header
+// with phis for the parameters (the receiver is just the first one).
+// Any other tail call becomes a tailcall control, reusing the frame.
+// Expects SSA form.
+class TailCallOptimizer : public IdentityOptimizer
+{
+   private:
+      unsigned long _tail_counter = 0;
+      std::string _curr_class;
+      std::vector<std::string> _curr_vtable;
+      std::map<std::string, std::shared_ptr<PrimitiveStatement>> _defs;
+      std::map<std::string, std::string> _var_to_type;
+      // Call ending the block if its result is all the block returns
+      CallPrimitive * tailCall(std::shared_ptr<BasicBlock> block) {
+         RetControl * ret = dynamic_cast<RetControl*>(block->control().get());
+         std::vector<std::shared_ptr<PrimitiveStatement>> primitives = block->primitives();
+         if (ret == nullptr || primitives.size() == 0) {
+            return nullptr;
+         }
+         CallPrimitive * call = dynamic_cast<CallPrimitive*>(primitives.back().get());
+         if (call == nullptr || call->lhs() != ret->val()) {
+            return nullptr;
+         }
+         return call;
+      }
+      // There is no inheritance, so a vtable slot loaded from an object of
+      // this class is always the same code
+      bool isSelfCall(CallPrimitive * call, std::string method_name, unsigned long num_params) {
+         if (_defs.find(call->codeaddr()) == _defs.end() || call->args().size() + 1 != num_params) {
+            return false;
+         }
+         GetEltPrimitive * method = dynamic_cast<GetEltPrimitive*>(_defs[call->codeaddr()].get());
+         if (method == nullptr || !isNumber(method->index()) || _defs.find(method->arr()) == _defs.end()) {
+            return false;
+         }
+         LoadPrimitive * vtable = dynamic_cast<LoadPrimitive*>(_defs[method->arr()].get());
+         if (vtable == nullptr || _var_to_type[vtable->addr()] != _curr_class) {
+            return false;
+         }
+         unsigned long index = std::stoul(method->index());
+         return index < _curr_vtable.size() && _curr_vtable[index] == method_name;
+      }
+      // Unused SSA version of a variable (x0 -> x1), or a fresh temporary
+      std::string freshName(std::string reg, std::set<std::string> & taken, unsigned long & next_temp) {
+         std::string base = reg;
+         while (base.length() > 1 && std::isdigit(base.back())) {
+            base.pop_back();
+         }
+         if (base == reg || !isVariable(base)) {
+            return toRegister(std::to_string(next_temp++));
+         }
+         unsigned long version = 0;
+         while (taken.find(base + std::to_string(version)) != taken.end()) {
+            version++;
+         }
+         taken.insert(base + std::to_string(version));
+         return base + std::to_string(version);
+      }
+   public:
+      void visit(MethodCFG& node) {
+         if (_curr_class == "") {
+            // Main has no caller to return to
+            IdentityOptimizer::visit(node);
+            return;
+         }
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         DominatorSolver ds;
+         std::map<std::string, std::shared_ptr<BasicBlock>> blockmap = ds.solveBlockmap(method);
+         CFGLinker linker;
+         std::vector<std::string> order = linker.order(method);
+         std::string entry = order[0];
+         std::vector<std::string> params = blockmap[entry]->params();
+         _var_to_type = node.var_to_type();
+         _defs.clear();
+         std::map<std::string, unsigned long> uses;
+         for (const auto & label : order) {
+            for (const auto & p : blockmap[label]->primitives()) {
+               for (const auto & l : p->LHS()) {
+                  _defs[l] = p;
+               }
+               std::vector<std::string> rhs = p->RHS();
+               PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+               if (phi != nullptr) {
+                  rhs.clear();
+                  for (const auto & arg : phi->args()) {
+                     rhs.push_back(arg.second);
+                  }
+               }
+               for (const auto & r : rhs) {
+                  uses[r]++;
+               }
+            }
+            for (const auto & r : blockmap[label]->control()->RHS()) {
+               uses[r]++;
+            }
+         }
+         std::set<std::string> self_tails;
+         std::set<std::string> other_tails;
+         for (const auto & label : order) {
+            CallPrimitive * call = tailCall(blockmap[label]);
+            if (call == nullptr) {
+               continue;
+            }
+            if (isSelfCall(call, entry, params.size())) {
+               self_tails.insert(label);
+            } else {
+               other_tails.insert(label);
+            }
+         }
+         if (self_tails.size() == 0 && other_tails.size() == 0) {
+            IdentityOptimizer::visit(node);
+            return;
+         }
+         std::vector<std::shared_ptr<BasicBlock>> blocks;
+         std::string header = entry;
+         std::shared_ptr<BasicBlock> header_block;
+         if (self_tails.size() > 0) {
+            // Old entry becomes the loop header, parameters are merged there
+            header = "tail" + std::to_string(++_tail_counter);
+            unsigned long next_temp = CFGLinker::nextTemporary(blockmap);
+            std::set<std::string> taken(params.begin(), params.end());
+            for (const auto & kv : _defs) {
+               taken.insert(kv.first);
+            }
+            std::vector<std::string> entry_params;
+            for (const auto & p : params) {
+               std::string fresh = freshName(p, taken, next_temp);
+               _var_to_type[fresh] = _var_to_type[p];
+               entry_params.push_back(fresh);
+            }
+            std::shared_ptr<BasicBlock> entry_block = std::make_shared<BasicBlock>(entry, entry_params);
+            entry_block->setControl(std::make_shared<JumpControl>(header));
+            blocks.push_back(entry_block);
+            header_block = std::make_shared<BasicBlock>(header);
+            for (unsigned long i=0; i<params.size(); i++) {
+               std::vector<std::pair<std::string, std::string>> args = { std::make_pair(entry, entry_params[i]) };
+               for (const auto & t : self_tails) {
+                  CallPrimitive * call = tailCall(blockmap[t]);
+                  std::string arg = i == 0 ? call->receiver() : call->args()[i - 1];
+                  args.push_back(std::make_pair(t == entry ? header : t, arg));
+               }
+               header_block->appendPrimitive(std::make_shared<PhiPrimitive>(params[i], args));
+            }
+         }
+         for (const auto & label : order) {
+            std::shared_ptr<BasicBlock> block = blockmap[label];
+            std::shared_ptr<BasicBlock> new_block = label == entry && header_block ? header_block
+               : std::make_shared<BasicBlock>(label, block->params());
+            std::vector<std::shared_ptr<PrimitiveStatement>> primitives = block->primitives();
+            CallPrimitive * call = tailCall(block);
+            std::set<std::string> dead;
+            if (self_tails.count(label)) {
+               // Method lookup for the call is dead now, unless shared
+               primitives.pop_back();
+               GetEltPrimitive * method = dynamic_cast<GetEltPrimitive*>(_defs[call->codeaddr()].get());
+               if (--uses[call->codeaddr()] == 0) {
+                  dead.insert(call->codeaddr());
+                  if (--uses[method->arr()] == 0) {
+                     dead.insert(method->arr());
+                  }
+               }
+            } else if (other_tails.count(label)) {
+               primitives.pop_back();
+            }
+            for (const auto & p : primitives) {
+               std::vector<std::string> lhs = p->LHS();
+               PhiPrimitive * phi = dynamic_cast<PhiPrimitive*>(p.get());
+               if (lhs.size() == 1 && dead.find(lhs[0]) != dead.end()) {
+                  continue;
+               } else if (phi != nullptr && header != entry) {
+                  // Edges out of the old entry now leave from the header
+                  std::vector<std::pair<std::string, std::string>> args;
+                  for (const auto & arg : phi->args()) {
+                     args.push_back(std::make_pair(arg.first == entry ? header : arg.first, arg.second));
+                  }
+                  new_block->appendPrimitive(std::make_shared<PhiPrimitive>(phi->lhs(), args));
+               } else {
+                  new_block->appendPrimitive(p);
+               }
+            }
+            if (self_tails.count(label)) {
+               new_block->setControl(std::make_shared<JumpControl>(header));
+            } else if (other_tails.count(label)) {
+               new_block->setControl(std::make_shared<TailCallControl>(call->codeaddr(), call->receiver(), call->args()));
+            } else {
+               new_block->setControl(block->control());
+            }
+            blocks.push_back(new_block);
+         }
+         _new_method = linker.link(blocks, node.variables(), _var_to_type);
+      }
+      void visit(ClassCFG& node) {
+         _curr_class = node.name();
+         _curr_vtable = node.vtable();
+         IdentityOptimizer::visit(node);
+      }
+      void visit(ProgramCFG& node) {
+         _curr_class = "";
+         IdentityOptimizer::visit(node);
+      }
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include "CFG.h"
 #include "DominatorSolver.h"
 #include "IdentityOptimizer.h"
+#include "RewriteRules.h"
 
 // This will iterate dominator tree instead of literal tree
 class ValueNumberOptimizer : public IdentityOptimizer
@@ -52,87 +53,18 @@ class ValueNumberOptimizer : public IdentityOptimizer
          std::string op1 = getVN(node.op1());
          std::string op2 = getVN(node.op2());
          std::vector<std::string> args = { op1, op2 };
-         // Can we simplify expr?
          // If op is +, *, |, &, ^, args are commutative, sort them for consistency
-         if (op == '+' || op == '*' || op == '|' || op == '&' || op == '^') {
+         if (RewriteRules::commutative(op)) {
             std::sort(args.begin(), args.end());
          }
-         if (op == '+') {
-            // Addition identities
-            if (args[0] == "0") {
-               // Direct assignment x = 0 + y
-               op = '=';
-               args = { args[1] };
-            } else if (args[1] == "0") {
-               // Direct assignment x = y + 0
-               op = '=';
-               args = { args[0] };
-            } 
-         } else if (op == '-') {
-            // Subtraction identities
-            if (args[1] == "0") {
-               // Direct assignment x = y - 0
-               op = '=';
-               args = { args[0] };
-            } else if (args[0] == args[1]) {
-               // x = y - y = 0
-               op = '=';
-               args = { "0" };
-            }
-         } else if (op == '*') {
-            if (args[0] == "1") {
-               // Direct assignment x = 1 * y
-               op = '=';
-               args = { args[1] };
-            } else if (args[1] == "1") {
-               // Direct assignment x = y * 1
-               op = '=';
-               args = { args[0] };
-            } else if (args[0] == "2") {
-               // Replace with addition
-               op = '+';
-               args = { args[1], args[1] };
-            } else if (args[1] == "2") {
-               // Replace with addition
-               op = '+';
-               args = { args[0], args[0] };
-            } else if (args[0] == "0" || args[1] == "0") {
-               // Direct assignment x = 0 * y = 0 = y * 0
-               op = '=';
-               args = { "0" };
-            }
-         } else if (op == '/') {
-            // Cannot simplify 0 / y if y might be 0
-            if (args[1] == "1") {
-               // Direct assignment x = y / 1
-               op = '=';
-               args = { args[0] };
-            }
-            // Cannot simplify y / y if y might be 0
-         }
-         // Check if we have const expression and replace it
-         if (op != '=' && isNumber(args[0]) && isNumber(args[1])) {
-            std::string arg;
-            if (op == '+') {
-               arg = std::to_string(std::stoull(args[0]) + std::stoull(args[1]));
-            } else if (op == '-') {
-               arg = std::to_string(std::stoull(args[0]) - std::stoull(args[1]));
-            } else if (op == '*') {
-               arg = std::to_string(std::stoull(args[0]) * std::stoull(args[1]));
-            } else if (op == '/') {
-               arg = std::to_string(std::stoull(args[0]) / std::stoull(args[1]));
-            } else if (op == '&') {
-               arg = std::to_string(std::stoull(args[0]) & std::stoull(args[1]));
-            } else if (op == '|') {
-               arg = std::to_string(std::stoull(args[0]) | std::stoull(args[1]));
-            } else {
-               // Assume XOR
-               arg = std::to_string(std::stoull(args[0]) ^ std::stoull(args[1]));
-            }
-            op = '=';
+         // Fold constants and simplify identities (x * 1, x - x, ...)
+         RewriteRules::Result simple = RewriteRules::simplify(op, args[0], args[1]);
+         op = simple.op;
+         if (op == '=') {
             // Might need to remap to value number
-            arg = getVN(arg);
-            args = { arg };
+            args = { getVN(simple.op1) };
+         } else {
+            args = { simple.op1, simple.op2 };
          }
          // Check if expr is in hash table
          std::pair<char, std::vector<std::string>> hash = std::make_pair(op, args);
@@ -270,23 +202,97 @@ class ValueNumberOptimizer : public IdentityOptimizer
          } 
       }
       void visit(StoreVectorPrimitive& node) {
-         std::vector<std::string> vals;
-         for (const auto & v : node.vals()) {
-            vals.push_back(getVN(v));
+         std::string rhs = getVN(node.rhs());
+         std::vector<std::string> vals = node.vals();
+         // Each lane of a vector stored before is already in a register
+         bool stored = true;
+         for (unsigned long i=0; i<vals.size(); i++) {
+            std::pair<char, std::vector<std::string>> hash = std::make_pair('W', std::vector<std::string>({ rhs, std::to_string(i) }));
+            stored = stored && (vals[i] == "%UNUSED" || _hashtable.find(hash) != _hashtable.end());
+         }
+         if (stored) {
+            for (unsigned long i=0; i<vals.size(); i++) {
+               if (vals[i] != "%UNUSED") {
+                  _vn[vals[i]] = _hashtable[std::make_pair('W', std::vector<std::string>({ rhs, std::to_string(i) }))];
+               }
+            }
+            // By default do NOT add primitive
+            return;
+         }
+         for (unsigned long i=0; i<vals.size(); i++) {
+            if (vals[i] != "%UNUSED") {
+               _vn[vals[i]] = vals[i];
+               _hashtable[std::make_pair('W', std::vector<std::string>({ rhs, std::to_string(i) }))] = vals[i];
+            }
+         }
+         // Loading the lanes back in is just the vector
+         if (std::find(vals.begin(), vals.end(), "%UNUSED") == vals.end()) {
+            _hashtable[std::make_pair('V', vals)] = rhs;
+         }
+         _new_block->appendPrimitive(std::make_shared<StoreVectorPrimitive>(vals, rhs));
+      }
+      // Vector operations hash like arithmetic, op is a code for the kind
+      template <typename T>
+      void visitVectorOp(T& node, char op) {
+         std::vector<std::string> args = { getVN(node.op1()), getVN(node.op2()) };
+         if (op == 'A' || op == 'M') {
+            std::sort(args.begin(), args.end());
+         }
+         std::pair<char, std::vector<std::string>> hash = std::make_pair(op, args);
+         if (_hashtable.find(hash) != _hashtable.end()) {
+            // In hash table
+            // Map node's LHS to hash associated VN
+            _vn[node.lhs()] = _hashtable[hash];
+            // By default do NOT add primitive
+         } else {
+            _vn[node.lhs()] = node.lhs();
+            _hashtable[hash] = node.lhs();
+            _new_block->appendPrimitive(std::make_shared<T>(node.lhs(), args[0], args[1]));
          }
-         _new_block->appendPrimitive(std::make_shared<StoreVectorPrimitive>(vals, getVN(node.rhs())));
       }
       void visit(AddVectorPrimitive& node) {
-         _new_block->appendPrimitive(std::make_shared<AddVectorPrimitive>(getVN(node.lhs()), getVN(node.op1()), getVN(node.op2())));
+         visitVectorOp(node, 'A');
       }
       void visit(SubtractVectorPrimitive& node) {
-         _new_block->appendPrimitive(std::make_shared<SubtractVectorPrimitive>(getVN(node.lhs()), getVN(node.op1()), getVN(node.op2())));
+         visitVectorOp(node, 'S');
       }
       void visit(MultiplyVectorPrimitive& node) {
-         _new_block->appendPrimitive(std::make_shared<MultiplyVectorPrimitive>(getVN(node.lhs()), getVN(node.op1()), getVN(node.op2())));
+         visitVectorOp(node, 'M');
       }
       void visit(DivideVectorPrimitive& node) {
-         _new_block->appendPrimitive(std::make_shared<DivideVectorPrimitive>(getVN(node.lhs()), getVN(node.op1()), getVN(node.op2())));
+         visitVectorOp(node, 'D');
+      }
+      void visit(ReduceVectorPrimitive& node) {
+         std::vector<std::string> args = { std::string(1, node.op()), getVN(node.rhs()) };
+         std::pair<char, std::vector<std::string>> hash = std::make_pair('R', args);
+         if (_hashtable.find(hash) != _hashtable.end()) {
+            _vn[node.lhs()] = _hashtable[hash];
+         } else {
+            _vn[node.lhs()] = node.lhs();
+            _hashtable[hash] = node.lhs();
+            _new_block->appendPrimitive(std::make_shared<ReduceVectorPrimitive>(node.lhs(), node.op(), args[1]));
+         }
+      }
+      void visit(ShuffleVectorPrimitive& node) {
+         std::vector<std::string> args = { getVN(node.rhs()) };
+         for (const auto & i : node.indices()) {
+            args.push_back(std::to_string(i));
+         }
+         std::pair<char, std::vector<std::string>> hash = std::make_pair('X', args);
+         if (_hashtable.find(hash) != _hashtable.end()) {
+            _vn[node.lhs()] = _hashtable[hash];
+         } else {
+            _vn[node.lhs()] = node.lhs();
+            _hashtable[hash] = node.lhs();
+            _new_block->appendPrimitive(std::make_shared<ShuffleVectorPrimitive>(node.lhs(), args[0], node.indices()));
+         }
+      }
+      // Memory isn't numbered, like getelt and setelt
+      void visit(GetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<GetEltVectorPrimitive>(node.lhs(), getVN(node.arr()), getVN(node.index()), node.width()));
+      }
+      void visit(SetEltVectorPrimitive& node) {
+         _new_block->appendPrimitive(std::make_shared<SetEltVectorPrimitive>(getVN(node.arr()), getVN(node.index()), getVN(node.val())));
       }
       void visit(FailControl& node) {
          _new_block->setControl(std::make_shared<FailControl>(node.message()));
@@ -374,6 +380,16 @@ class ValueNumberOptimizer : public IdentityOptimizer
       void visit(RetControl& node) {
          _new_block->setControl(std::make_shared<RetControl>(getVN(node.val())));
       }
+      void visit(TailCallControl& node) {
+         std::vector<std::string> new_args;
+         for (const auto& arg : node.args()) {
+            new_args.push_back(getVN(arg));
+         }
+         _new_block->setControl(std::make_shared<TailCallControl>(
+                  getVN(node.codeaddr()),
+                  getVN(node.receiver()),
+                  new_args));
+      }
       void adjustChildPhi(std::shared_ptr<BasicBlock>& c) {
          std::string child_label = c->label();
          // DO NOT OPTIMIZE CHILD DIRECTLY
@@ -479,9 +495,14 @@ class ValueNumberOptimizer : public IdentityOptimizer
          // Push the modified table onto the stack
          _htstack.push(_hashtable);
          std::vector<std::shared_ptr<DomTreeNode>> acceptable_children;
-         // Only keep non-pruned blocks
+         // Only keep non-pruned blocks, a shared failure block is still
+         // reached from other checks though
          for (const auto& child : children) {
-            if (_prunelabels.find(child->block()->label()) == _prunelabels.end()) {
+            bool pruned = _prunelabels.find(child->block()->label()) != _prunelabels.end();
+            for (const auto & pred : child->block()->predecessors()) {
+               pruned = pruned && pred.lock()->label() == node.label();
+            }
+            if (!pruned) {
                acceptable_children.push_back(child);
             }
          }
@@ -543,6 +564,9 @@ class ValueNumberOptimizer : public IdentityOptimizer
             kv.second->accept(*this);
             _new_prog->appendClass(_new_class);
          }
+         for (auto & kv : node.globals()) {
+            _new_prog->appendGlobal(kv.first, kv.second);
+         }
       }
 };
 
@@ -1,26 +1,513 @@
 #ifndef _CS_441_VECTOR_OPTIMIZER_H
 #define _CS_441_VECTOR_OPTIMIZER_H
+#include <deque>
+#include <functional>
 #include <map>
+#include <queue>
 #include <set>
 #include <stack>
+#include <tuple>
 #include <vector>
+#include "AliasAnalysis.h"
 #include "CFG.h"
+#include "DependenceGraph.h"
+#include "DominatorSolver.h"
 #include "IdentityOptimizer.h"
+#include "Profile.h"
 
-using Pack_t = std::vector<std::shared_ptr<PrimitiveStatement>>;
-using PackSet_t = std::set<Pack_t>;
+// Packs are statement offsets into the block being vectorized
+using Pack_t = std::vector<unsigned long>;
+using PackSet_t = std::vector<Pack_t>;
 
 class VectorOptimizer : public IdentityOptimizer
 {
    private:
-      std::set<std::string> _scheduled;
+      AliasAnalysis _aa;
       size_t _vector_counter;
-      std::shared_ptr<BasicBlock> SLP_extract(std::shared_ptr<BasicBlock> B) {
-         PackSet_t P;
-         P = find_adj_refs(B, P); 
-         P = extend_packlist(B, P);
-         P = combine_packs(P);
-         return schedule(B, _new_block, P);
+      // Lanes per vector on the target, a power of two
+      unsigned long _width;
+      // Blocks the profile never saw run are not worth packing
+      Profile _profile;
+      std::string _method;
+      // Index of the block being vectorized, so pack discovery never has
+      // to search the whole block
+      std::string _label;
+      std::vector<std::shared_ptr<PrimitiveStatement>> _stmts;
+      std::vector<std::vector<std::string>> _lhs;
+      std::vector<std::vector<std::string>> _rhs;
+      // Register to the statements defining it alone, and using it
+      std::map<std::string, std::vector<unsigned long>> _defs;
+      std::map<std::string, std::vector<unsigned long>> _uses;
+      // (getelt or setelt, base, slot) to the statements accessing it
+      std::map<std::tuple<bool, std::string, long>, std::vector<unsigned long>> _refs;
+      // Pairs found so far, in order, and who is already first or second
+      PackSet_t _pairs;
+      std::set<std::pair<unsigned long, unsigned long>> _paired;
+      std::set<unsigned long> _firsts;
+      std::set<unsigned long> _seconds;
+      // A tree of one associative operation whose inner results are read by
+      // nothing else, its statements in block order (so the root is last)
+      // and the operands at its leaves from left to right
+      struct Reduction {
+         char op;
+         Pack_t stmts;
+         std::vector<std::string> leaves;
+      };
+      std::vector<Reduction> _reductions;
+      std::set<unsigned long> _reduced;
+      std::set<std::string> _control_rhs;
+      // Lanes held by each vector register in the block, and the other
+      // way around, so chained packs can use a vector as it is
+      std::map<std::vector<std::string>, std::string> _vectors;
+      std::map<std::string, std::set<std::vector<std::string>>> _lane_of;
+      // Registers used by a phi, and the blocks using each register otherwise
+      std::set<std::string> _phi_used;
+      std::map<std::string, std::set<std::string>> _users;
+      void index(std::shared_ptr<BasicBlock> B) {
+         _label = B->label();
+         _stmts = B->primitives();
+         _lhs.clear();
+         _rhs.clear();
+         _defs.clear();
+         _uses.clear();
+         _refs.clear();
+         _pairs.clear();
+         _paired.clear();
+         _firsts.clear();
+         _seconds.clear();
+         std::vector<std::string> control = B->control()->RHS();
+         _control_rhs = std::set<std::string>(control.begin(), control.end());
+         for (unsigned long i=0; i<_stmts.size(); i++) {
+            _lhs.push_back(_stmts[i]->LHS());
+            _rhs.push_back(_stmts[i]->RHS());
+            if (_lhs[i].size() == 1) {
+               _defs[_lhs[i][0]].push_back(i);
+            }
+            std::set<std::string> used(_rhs[i].begin(), _rhs[i].end());
+            for (const auto & r : used) {
+               _uses[r].push_back(i);
+            }
+            bool getelt;
+            std::string arr;
+            long slot;
+            if (ref(i, getelt, arr, slot)) {
+               _refs[std::make_tuple(getelt, arr, slot)].push_back(i);
+            }
+         }
+      }
+      // Statement i is a getelt or setelt at a constant slot
+      bool ref(unsigned long i, bool & getelt, std::string & arr, long & slot) {
+         GetEltPrimitive* ge = dynamic_cast<GetEltPrimitive*>(_stmts[i].get());
+         SetEltPrimitive* se = dynamic_cast<SetEltPrimitive*>(_stmts[i].get());
+         std::string index;
+         if (ge != nullptr) {
+            arr = ge->arr();
+            index = ge->index();
+         } else if (se != nullptr) {
+            arr = se->arr();
+            index = se->index();
+         } else {
+            return false;
+         }
+         if (index.empty()) {
+            return false;
+         }
+         for (char const &ch : index) {
+            if (std::isdigit(ch) == 0) return false;
+         }
+         getelt = ge != nullptr;
+         slot = std::stol(index);
+         return true;
+      }
+      void SLP_extract(std::shared_ptr<BasicBlock> B, std::shared_ptr<BasicBlock> B2) {
+         index(B);
+         find_reductions();
+         find_adj_refs();
+         extend_packlist(0);
+         unsigned long seeded = _pairs.size();
+         find_isomorphic_roots();
+         extend_packlist(seeded);
+         schedule(B2, select_packs(combine_packs()));
+      }
+      bool isVectorOp(unsigned long i) {
+         ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(_stmts[i].get());
+         return a != nullptr && (a->op() == '+' || a->op() == '-' || a->op() == '*' || a->op() == '/');
+      }
+      // Where a register comes from, the object it is a field of or the
+      // operation computing it
+      std::string source(std::string r) {
+         auto d = _defs.find(r);
+         if (d == _defs.end()) {
+            return r;
+         }
+         bool getelt;
+         std::string arr;
+         long slot;
+         ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(_stmts[d->second[0]].get());
+         if (ref(d->second[0], getelt, arr, slot)) {
+            return arr;
+         }
+         return a != nullptr ? std::string(1, a->op()) : r;
+      }
+      // Lanes of the vector a pack of this many statements goes in, the
+      // full width or, for what is left over, the narrowest that fits
+      unsigned long vector_width(unsigned long size) {
+         unsigned long width = 2;
+         while (width < size && width < _width) {
+            width *= 2;
+         }
+         return width;
+      }
+      // Operand (0 or 1) or result (2) lanes of an arithmetic pack, padded
+      // out to a whole vector
+      // Value numbering sorts the operands of + and *, so those are swapped
+      // back wherever only the second one comes from where most operands do
+      std::vector<std::string> lanes(const Pack_t & p, int which) {
+         std::vector<std::string> args;
+         char op = '+';
+         std::map<std::string, unsigned long> count;
+         std::string first;
+         for (const auto & i : p) {
+            ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(_stmts[i].get());
+            for (const auto & src : { source(a->op1()), source(a->op2()) }) {
+               if (++count[src] > count[first]) {
+                  first = src;
+               }
+            }
+         }
+         for (const auto & i : p) {
+            ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(_stmts[i].get());
+            bool swap = (a->op() == '+' || a->op() == '*') && source(a->op1()) != first && source(a->op2()) == first;
+            args.push_back(which == 0 ? (swap ? a->op2() : a->op1()) : which == 1 ? (swap ? a->op1() : a->op2()) : a->lhs());
+            op = a->op();
+         }
+         while (args.size() < vector_width(p.size())) {
+            // Padding divides by one so the unused lanes can't trap
+            args.push_back(which == 2 ? "%UNUSED" : std::to_string(which == 1 && op == '/' ? 1 : 0));
+         }
+         return args;
+      }
+      bool isReduceOp(char op) {
+         return op == '+' || op == '*' || op == '&' || op == '|' || op == '^';
+      }
+      // Operand r of statement i is an inner node of its tree, defined by
+      // statement j with the same operation and read nowhere else
+      bool inner(unsigned long i, std::string r, char op, unsigned long & j) {
+         auto d = _defs.find(r);
+         if (d == _defs.end() || d->second.size() != 1 || d->second[0] >= i) {
+            return false;
+         }
+         j = d->second[0];
+         ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(_stmts[j].get());
+         return a != nullptr && a->op() == op && _uses[r].size() == 1
+            && _control_rhs.find(r) == _control_rhs.end() && !live_out(r);
+      }
+      // Finds the largest trees of two or more statements, these are kept
+      // out of ordinary packs so the leaves can be summed up in a vector
+      void find_reductions() {
+         _reductions.clear();
+         _reduced.clear();
+         std::set<unsigned long> inners;
+         for (unsigned long i=0; i<_stmts.size(); i++) {
+            ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(_stmts[i].get());
+            unsigned long j;
+            if (a == nullptr || !isReduceOp(a->op()) || a->op1() == a->op2()) {
+               continue;
+            }
+            for (const auto & r : { a->op1(), a->op2() }) {
+               if (inner(i, r, a->op(), j)) {
+                  inners.insert(j);
+               }
+            }
+         }
+         for (unsigned long i=0; i<_stmts.size(); i++) {
+            ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(_stmts[i].get());
+            if (a == nullptr || !isReduceOp(a->op()) || inners.find(i) != inners.end()) {
+               continue;
+            }
+            Reduction red = { a->op(), { i }, {} };
+            // Operands still to look at with the statement reading them,
+            // the leftmost on top
+            std::stack<std::pair<unsigned long, std::string>> operands;
+            operands.push(std::make_pair(i, a->op2()));
+            operands.push(std::make_pair(i, a->op1()));
+            while (!operands.empty()) {
+               std::pair<unsigned long, std::string> o = operands.top();
+               operands.pop();
+               ArithmeticPrimitive* parent = dynamic_cast<ArithmeticPrimitive*>(_stmts[o.first].get());
+               unsigned long j;
+               if (parent->op1() != parent->op2() && inner(o.first, o.second, red.op, j)) {
+                  ArithmeticPrimitive* child = dynamic_cast<ArithmeticPrimitive*>(_stmts[j].get());
+                  red.stmts.push_back(j);
+                  operands.push(std::make_pair(j, child->op2()));
+                  operands.push(std::make_pair(j, child->op1()));
+               } else {
+                  red.leaves.push_back(o.second);
+               }
+            }
+            // More than one constant is something for value numbering to fold
+            long constants = std::count_if(red.leaves.begin(), red.leaves.end(), [&] (const std::string & l) { return isNumber(l); });
+            if (red.stmts.size() > 1 && constants < 2) {
+               std::sort(red.stmts.begin(), red.stmts.end());
+               _reduced.insert(red.stmts.begin(), red.stmts.end());
+               _reductions.push_back(red);
+            }
+         }
+      }
+      // Leaves of a reduction a vector at a time, a single one left over
+      // is folded in as a scalar
+      std::vector<std::vector<std::string>> chunks(const Reduction & red) {
+         std::vector<std::vector<std::string>> c;
+         for (unsigned long i=0; i+1<red.leaves.size(); i+=_width) {
+            c.push_back(std::vector<std::string>(red.leaves.begin() + i, red.leaves.begin() + std::min(red.leaves.size(), i + _width)));
+         }
+         return c;
+      }
+      std::vector<std::string> sorted(std::vector<std::string> lanes) {
+         std::sort(lanes.begin(), lanes.end());
+         return lanes;
+      }
+      // Every lane of args can be shuffled out of a vector with these lanes
+      bool shuffles(const std::vector<std::string> & args, const std::vector<std::string> & lanes) {
+         if (std::find(lanes.begin(), lanes.end(), "%UNUSED") != lanes.end()) {
+            return false;
+         }
+         for (const auto & a : args) {
+            if (std::find(lanes.begin(), lanes.end(), a) == lanes.end()) {
+               return false;
+            }
+         }
+         return true;
+      }
+      // The setelts of memory pack m storing these lanes write consecutive
+      // slots of one object, so a vecsetelt can take them from a vector
+      bool stored_whole(const std::map<unsigned long, unsigned long> & store_of, unsigned long m, const std::vector<std::string> & lanes) {
+         std::set<long> slots;
+         std::set<std::string> stored;
+         std::string base;
+         for (const auto & l : lanes) {
+            for (const auto & u : _uses[l]) {
+               auto st = store_of.find(u);
+               SetEltPrimitive* se = dynamic_cast<SetEltPrimitive*>(_stmts[u].get());
+               bool getelt;
+               std::string arr;
+               long slot;
+               if (st == store_of.end() || st->second != m || se->val() != l) {
+                  continue;
+               }
+               if (!ref(u, getelt, arr, slot) || (base != "" && arr != base)) {
+                  return false;
+               }
+               base = arr;
+               slots.insert(slot);
+               stored.insert(l);
+            }
+         }
+         return slots.size() == lanes.size() && stored.size() == lanes.size()
+            && *slots.rbegin() - *slots.begin() == (long) lanes.size() - 1;
+      }
+      // Arithmetic packs are cut into vectors of the target width, a
+      // narrower one taking the remainder, and each one is only kept if
+      // it takes no more instructions than the scalar statements it
+      // replaces: the operation, a vecload per operand that isn't already
+      // in a vector, and a vecstore if any lane is needed as a scalar.
+      // Dropping a vector only makes the others cost more, so unprofitable
+      // ones are dropped until the rest all pay off. Reductions are kept
+      // the same way, but only when they save something, as a vecreduce
+      // per vector of leaves, a vecload for those not already in one, and
+      // the scalar operations putting the vectors together.
+      PackSet_t select_packs(PackSet_t P) {
+         PackSet_t packs;
+         std::vector<Pack_t> vectors;
+         for (const auto & p : P) {
+            if (!isVectorOp(p[0])) {
+               packs.push_back(p);
+               continue;
+            }
+            for (unsigned long i=0; i<p.size(); i+=_width) {
+               vectors.push_back(Pack_t(p.begin() + i, p.begin() + std::min(p.size(), i + _width)));
+            }
+         }
+         std::sort(vectors.begin(), vectors.end());
+         std::vector<bool> kept(vectors.size(), true);
+         std::map<unsigned long, unsigned long> vector_of;
+         for (unsigned long v=0; v<vectors.size(); v++) {
+            for (const auto & i : vectors[v]) {
+               vector_of[i] = v;
+            }
+         }
+         // Setelts in a memory pack
+         std::map<unsigned long, unsigned long> store_of;
+         for (unsigned long m=0; m<packs.size(); m++) {
+            for (const auto & i : packs[m]) {
+               if (dynamic_cast<SetEltPrimitive*>(_stmts[i].get()) != nullptr) {
+                  store_of[i] = m;
+               }
+            }
+         }
+         std::vector<bool> reduced(_reductions.size(), true);
+         std::map<unsigned long, unsigned long> reduction_of;
+         std::vector<std::set<std::vector<std::string>>> reduction_lanes;
+         for (unsigned long r=0; r<_reductions.size(); r++) {
+            for (const auto & i : _reductions[r].stmts) {
+               reduction_of[i] = r;
+            }
+            reduction_lanes.push_back({});
+            for (const auto & c : chunks(_reductions[r])) {
+               reduction_lanes[r].insert(sorted(c));
+            }
+         }
+         bool changed = true;
+         while (changed) {
+            changed = false;
+            // Lanes some kept vector already has in a register, and the
+            // same in any order
+            std::set<std::vector<std::string>> available;
+            std::set<std::vector<std::string>> available_sorted;
+            for (unsigned long v=0; v<vectors.size(); v++) {
+               if (kept[v]) {
+                  available.insert(lanes(vectors[v], 2));
+                  available_sorted.insert(sorted(lanes(vectors[v], 2)));
+               }
+            }
+            for (unsigned long r=0; r<_reductions.size(); r++) {
+               if (!reduced[r]) {
+                  continue;
+               }
+               std::vector<std::vector<std::string>> c = chunks(_reductions[r]);
+               bool leftover = _reductions[r].leaves.size() % _width == 1;
+               unsigned long cost = 2 * c.size() - 1 + (leftover ? 1 : 0);
+               for (const auto & lanes : c) {
+                  if (available_sorted.find(sorted(lanes)) == available_sorted.end()) {
+                     cost++;
+                  }
+               }
+               if (cost >= _reductions[r].stmts.size()) {
+                  reduced[r] = false;
+                  changed = true;
+               }
+            }
+            for (unsigned long v=0; v<vectors.size(); v++) {
+               if (!kept[v]) {
+                  continue;
+               }
+               unsigned long cost = 1;
+               for (int which=0; which<2; which++) {
+                  if (available.insert(lanes(vectors[v], which)).second) {
+                     cost++;
+                  }
+               }
+               // A lane read by anything but a kept vector taking it from
+               // these lanes, as they are or shuffled, has to be stored out
+               std::vector<std::string> result = lanes(vectors[v], 2);
+               bool unpack = false;
+               for (const auto & i : vectors[v]) {
+                  std::string lhs = _lhs[i][0];
+                  unpack = unpack || live_out(lhs);
+                  for (const auto & u : _uses[lhs]) {
+                     auto w = vector_of.find(u);
+                     auto r = reduction_of.find(u);
+                     auto m = store_of.find(u);
+                     if (r != reduction_of.end()) {
+                        unpack = unpack || !reduced[r->second]
+                           || reduction_lanes[r->second].find(sorted(result)) == reduction_lanes[r->second].end();
+                     } else if (m != store_of.end()) {
+                        unpack = unpack || !stored_whole(store_of, m->second, result);
+                     } else if (w == vector_of.end() || !kept[w->second]) {
+                        unpack = true;
+                     } else {
+                        for (int which=0; which<2; which++) {
+                           std::vector<std::string> operand = lanes(vectors[w->second], which);
+                           if (std::find(operand.begin(), operand.end(), lhs) != operand.end()) {
+                              unpack = unpack || !shuffles(operand, result);
+                           }
+                        }
+                     }
+                  }
+               }
+               if (unpack) {
+                  cost++;
+               }
+               if (cost > vectors[v].size()) {
+                  kept[v] = false;
+                  changed = true;
+               }
+            }
+         }
+         for (unsigned long v=0; v<vectors.size(); v++) {
+            if (kept[v]) {
+               packs.push_back(vectors[v]);
+            }
+         }
+         std::vector<Reduction> reductions;
+         for (unsigned long r=0; r<_reductions.size(); r++) {
+            if (reduced[r]) {
+               packs.push_back(_reductions[r].stmts);
+               reductions.push_back(_reductions[r]);
+            }
+         }
+         _reductions = reductions;
+         return packs;
+      }
+      void track(std::string vec, std::vector<std::string> lanes) {
+         _vectors[lanes] = vec;
+         for (const auto & l : lanes) {
+            _lane_of[l].insert(lanes);
+         }
+      }
+      // Reg was written, vectors holding its old value are stale
+      void invalidate(std::string reg) {
+         if (_lane_of.find(reg) == _lane_of.end()) {
+            return;
+         }
+         for (const auto & lanes : _lane_of[reg]) {
+            _vectors.erase(lanes);
+         }
+         _lane_of.erase(reg);
+      }
+      // Reg may be read after the block being vectorized
+      bool live_out(std::string reg) {
+         if (_phi_used.find(reg) != _phi_used.end()) {
+            return true;
+         }
+         auto users = _users.find(reg);
+         return users != _users.end() && (users->second.size() > 1 || users->second.find(_label) == users->second.end());
+      }
+      bool isVector(std::shared_ptr<PrimitiveStatement> p) {
+         return dynamic_cast<LoadVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<StoreVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<AddVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<SubtractVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<MultiplyVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<DivideVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<ReduceVectorPrimitive*>(p.get()) != nullptr
+            || dynamic_cast<ShuffleVectorPrimitive*>(p.get()) != nullptr;
+      }
+      // Drops the vector statements of a scheduled block nobody reads,
+      // mostly vecstores of lanes only the next pack wanted
+      std::vector<std::shared_ptr<PrimitiveStatement>> live_vectors(std::vector<std::shared_ptr<PrimitiveStatement>> primitives, std::shared_ptr<ControlStatement> control) {
+         std::vector<std::string> rhs = control->RHS();
+         std::set<std::string> live(rhs.begin(), rhs.end());
+         std::vector<std::shared_ptr<PrimitiveStatement>> kept;
+         for (auto p = primitives.rbegin(); p != primitives.rend(); p++) {
+            std::vector<std::string> lhs = (*p)->LHS();
+            bool used = !isVector(*p);
+            for (const auto & l : lhs) {
+               used = used || (l != "%UNUSED" && (live.find(l) != live.end() || live_out(l)));
+            }
+            if (!used) {
+               continue;
+            }
+            for (const auto & l : lhs) {
+               live.erase(l);
+            }
+            for (const auto & r : (*p)->RHS()) {
+               live.insert(r);
+            }
+            kept.push_back(*p);
+         }
+         std::reverse(kept.begin(), kept.end());
+         return kept;
       }
       bool isomorphic(std::shared_ptr<PrimitiveStatement> s1, std::shared_ptr<PrimitiveStatement> s2) {
          // Both must be GetElt or Arithmetic
@@ -41,135 +528,137 @@ class VectorOptimizer : public IdentityOptimizer
          }
          return false;
       }
-      bool independent(std::shared_ptr<PrimitiveStatement> s1, std::shared_ptr<PrimitiveStatement> s2) {
+      bool independent(unsigned long s1, unsigned long s2) {
          // s1 must not refer to s2
          // s2 must not refer to s1
-         std::vector<std::string> lhs1 = s1->LHS();
-         std::vector<std::string> lhs2 = s2->LHS();
-         std::vector<std::string> rhs1 = s1->RHS();
-         std::vector<std::string> rhs2 = s2->RHS();
-         for (const auto & r : rhs1) {
-            for (const auto & l : lhs2) {
-               if (l == r) {
-                  return false;
-               }
+         for (const auto & r : _rhs[s1]) {
+            if (std::find(_lhs[s2].begin(), _lhs[s2].end(), r) != _lhs[s2].end()) {
+               return false;
             }
          }
-         for (const auto & r : rhs2) {
-            for (const auto & l : lhs1) {
-               if (l == r) {
-                  return false;
-               }
+         for (const auto & r : _rhs[s2]) {
+            if (std::find(_lhs[s1].begin(), _lhs[s1].end(), r) != _lhs[s1].end()) {
+               return false;
             }
          }
          return true;
       }
-      bool adjacent(std::shared_ptr<PrimitiveStatement> s1, std::shared_ptr<PrimitiveStatement> s2) {
-         std::string i1, i2, arr1, arr2;
-         GetEltPrimitive* a1 = dynamic_cast<GetEltPrimitive*>(s1.get());
-         GetEltPrimitive* a2 = dynamic_cast<GetEltPrimitive*>(s2.get());
-         SetEltPrimitive* b1 = dynamic_cast<SetEltPrimitive*>(s1.get());
-         SetEltPrimitive* b2 = dynamic_cast<SetEltPrimitive*>(s2.get());
-         if (a1 != nullptr && a2 != nullptr) {
-            i1 = a1->index();
-            i2 = a2->index();
-            arr1 = a1->arr();
-            arr2 = a2->arr();
-         } else if (b1 != nullptr && b2 != nullptr) {
-            i1 = b1->index();
-            i2 = b2->index();
-            arr1 = b1->arr();
-            arr2 = b2->arr();
-         } else {
-            return false;
+      bool stmts_can_pack(unsigned long s1, unsigned long s2) {
+         // Assume alignment works
+         return s1 != s2 && isomorphic(_stmts[s1], _stmts[s2]) && independent(s1, s2)
+            && _firsts.find(s1) == _firsts.end() && _seconds.find(s2) == _seconds.end()
+            && _reduced.find(s1) == _reduced.end() && _reduced.find(s2) == _reduced.end();
+      }
+      void add_pack(unsigned long s1, unsigned long s2) {
+         // Avoid inserting same pack twice
+         if (_paired.find(std::make_pair(s2, s1)) == _paired.end() && _paired.insert(std::make_pair(s1, s2)).second) {
+            _pairs.push_back({ s1, s2 });
+            _firsts.insert(s1);
+            _seconds.insert(s2);
          }
-         // Array pointed to by both must be same
-         if (arr1 != arr2) {
-            return false;
+      }
+      void find_adj_refs() {
+         for (unsigned long s1=0; s1<_stmts.size(); s1++) {
+            bool getelt;
+            std::string arr;
+            long slot;
+            if (!ref(s1, getelt, arr, slot)) {
+               continue;
+            }
+            // Same array, next slot
+            auto adj = _refs.find(std::make_tuple(getelt, arr, slot+1));
+            if (adj == _refs.end()) {
+               continue;
+            }
+            for (const auto & s2 : adj->second) {
+               if (stmts_can_pack(s1, s2)) {
+                  add_pack(s1, s2);
+               }
+            }
          }
-         // Verify indices are off by one
-         for (char const &ch : i1) {
-            if (std::isdigit(ch) == 0) return false;
+      }
+      // The value of statement i leaves the block's arithmetic here, to a
+      // call, a print, the control, a later block or a reduction's leaves
+      bool root(unsigned long i, const std::set<std::string> & leaves) {
+         std::string lhs = _lhs[i][0];
+         if (_control_rhs.find(lhs) != _control_rhs.end() || live_out(lhs) || leaves.find(lhs) != leaves.end()) {
+            return true;
          }
-         for (char const &ch : i2) {
-            if (std::isdigit(ch) == 0) return false;
+         for (const auto & u : _uses[lhs]) {
+            if (dynamic_cast<CallPrimitive*>(_stmts[u].get()) != nullptr || dynamic_cast<PrintPrimitive*>(_stmts[u].get()) != nullptr) {
+               return true;
+            }
          }
-         return (std::stoi(i2) - std::stoi(i1) == 1);
+         return false;
       }
-      bool stmts_can_pack(std::shared_ptr<BasicBlock> B, PackSet_t P, std::shared_ptr<PrimitiveStatement> s1, std::shared_ptr<PrimitiveStatement> s2) {
-         if (isomorphic(s1, s2)) {
-            if (independent(s1, s2)) {
-               bool allt1 = true;
-               for (const auto & p : P) {
-                  std::shared_ptr<PrimitiveStatement> t = p[0];
-                  if (t == s1) {
-                     allt1 = false;
-                     break;
-                  }
-               }
-               if (allt1) {
-                  bool allt2 = true;
-                  for (const auto & p : P) {
-                     std::shared_ptr<PrimitiveStatement> t = p[1];
-                     if (t == s2) {
-                        allt2 = false;
-                        break;
-                     }
-                  }
-                  if (allt2) {
-                     // Assume alignment works
-                     return true;
-                  }
-               }
+      // Arithmetic nobody loads or stores still packs if it computes the
+      // same thing on independent values, like the arguments of a call.
+      // Roots no memory pack reached are paired with the next root with
+      // the same operation, and the packs grow from there.
+      void find_isomorphic_roots() {
+         std::set<std::string> leaves;
+         for (const auto & red : _reductions) {
+            leaves.insert(red.leaves.begin(), red.leaves.end());
+         }
+         // The roots chained so far for each operation
+         std::map<char, Pack_t> chain;
+         for (unsigned long i=0; i<_stmts.size(); i++) {
+            if (!isVectorOp(i) || _reduced.find(i) != _reduced.end() || _firsts.find(i) != _firsts.end()
+               || _seconds.find(i) != _seconds.end() || !root(i, leaves)) {
+               continue;
+            }
+            Pack_t & c = chain[dynamic_cast<ArithmeticPrimitive*>(_stmts[i].get())->op()];
+            if (!c.empty() && (!stmts_can_pack(c.back(), i) || reaches(c, i))) {
+               c.clear();
             }
+            if (!c.empty()) {
+               add_pack(c.back(), i);
+            }
+            c.push_back(i);
          }
-         return false;
       }
-      PackSet_t find_adj_refs(std::shared_ptr<BasicBlock> B, PackSet_t P) {
-         for (const auto & s1 : B->primitives()) {
-            for (const auto & s2 : B->primitives()) {
-               if (s1 != s2) {
-                  if (adjacent(s1, s2)) {
-                     if (stmts_can_pack(B, P, s1, s2)) {
-                        // Avoid inserting same pack twice
-                        if (P.find(Pack_t({ s2, s1 })) == P.end()) {
-                           P.insert(Pack_t({ s1, s2 }));
-                        }
+      // Statement i reads what one of the statements in c computes, through
+      // any number of statements in between
+      bool reaches(const Pack_t & c, unsigned long i) {
+         std::set<unsigned long> from(c.begin(), c.end());
+         std::set<unsigned long> seen;
+         std::stack<unsigned long> work;
+         work.push(i);
+         while (!work.empty()) {
+            unsigned long j = work.top();
+            work.pop();
+            for (const auto & r : _rhs[j]) {
+               auto d = _defs.find(r);
+               if (d == _defs.end()) {
+                  continue;
+               }
+               for (const auto & k : d->second) {
+                  if (k < j && k >= c.front() && seen.insert(k).second) {
+                     if (from.find(k) != from.end()) {
+                        return true;
                      }
+                     work.push(k);
                   }
                }
             }
          }
-         return P;
+         return false;
       }
-      PackSet_t follow_use_defs(std::shared_ptr<BasicBlock> B, PackSet_t P, Pack_t p) {
-         std::shared_ptr<PrimitiveStatement> s1 = p[0];
-         std::shared_ptr<PrimitiveStatement> s2 = p[1];
-         // Get s1 args
-         std::vector<std::string> x1 = s1->RHS();
-         // Get s2 args
-         std::vector<std::string> x2 = s2->RHS();
-         unsigned long m = x1.size();
-         std::vector<std::shared_ptr<PrimitiveStatement>> primitives = B->primitives();
-         for (unsigned long j=0; j<m; j++) {
+      void follow_use_defs(Pack_t p) {
+         // Get s1 and s2 args
+         std::vector<std::string> & x1 = _rhs[p[0]];
+         std::vector<std::string> & x2 = _rhs[p[1]];
+         for (unsigned long j=0; j<x1.size() && j<x2.size(); j++) {
+            if (_defs.find(x1[j]) == _defs.end() || _defs.find(x2[j]) == _defs.end()) {
+               continue;
+            }
             bool ts_exist = false;
-            for (const auto & t1 : primitives) {
-               for (const auto & t2 : primitives) {
-                  if (t1 != t2) {
-                     std::vector<std::string> t1_lhs = t1->LHS();
-                     std::vector<std::string> t2_lhs = t2->LHS();
-                     if (t1_lhs.size() == 1 && t2_lhs.size() == 1) {
-                        if (t1_lhs[0] == x1[j] && t2_lhs[0] == x2[j]) {
-                           if (stmts_can_pack(B, P, t1, t2)) {
-                              // Avoid inserting same pack twice
-                              if (P.find(Pack_t({ t2, t1 })) == P.end()) {
-                                 P.insert(Pack_t({ t1, t2 }));
-                              }
-                              ts_exist = true;
-                              break;
-                           }
-                        }
-                     }
+            for (const auto & t1 : _defs[x1[j]]) {
+               for (const auto & t2 : _defs[x2[j]]) {
+                  if (stmts_can_pack(t1, t2)) {
+                     add_pack(t1, t2);
+                     ts_exist = true;
+                     break;
                   }
                }
                if (ts_exist) {
@@ -177,140 +666,172 @@ class VectorOptimizer : public IdentityOptimizer
                }
             }
          }
-         return P;
       }
-      PackSet_t follow_def_uses(std::shared_ptr<BasicBlock> B, PackSet_t P, Pack_t p) {
-         std::shared_ptr<PrimitiveStatement> s1 = p[0];
-         std::shared_ptr<PrimitiveStatement> s2 = p[1];
-         // Get s1 lhs
-         std::vector<std::string> x1 = s1->LHS();
-         // Get s2 lhs
-         std::vector<std::string> x2 = s2->LHS();
-         if (x1.size() != 1 || x2.size() != 1) {
-            return P;
-         }
-         int savings = -1;
-         std::shared_ptr<PrimitiveStatement> u1;
-         std::shared_ptr<PrimitiveStatement> u2;
-         std::vector<std::shared_ptr<PrimitiveStatement>> primitives = B->primitives();
-         for (const auto & t1 : primitives) {
-            std::vector<std::string> t1_rhs = t1->RHS();
-            if (std::find(t1_rhs.begin(), t1_rhs.end(), x1[0]) != t1_rhs.end()) {
-               for (const auto & t2 : primitives) {
-                  std::vector<std::string> t2_rhs = t2->RHS();
-                  if (t1 != t2 && std::find(t2_rhs.begin(), t2_rhs.end(), x2[0]) != t2_rhs.end()) {
-                     if (stmts_can_pack(B, P, t1, t2)) {
-                        // Assume we save
-                        savings = 1;
-                        u1 = t1;
-                        u2 = t2;
-                     }
-                  }
-               }
-            }
+      // Instructions saved by packing s1 with s2, from what is packed so far
+      // One operation replaces two, and each operand pair already packed
+      // can come straight from a vector, anything else has to be loaded.
+      // Memory statements only line up other packs, they save nothing.
+      int estimate_savings(unsigned long s1, unsigned long s2) {
+         ArithmeticPrimitive* a1 = dynamic_cast<ArithmeticPrimitive*>(_stmts[s1].get());
+         ArithmeticPrimitive* a2 = dynamic_cast<ArithmeticPrimitive*>(_stmts[s2].get());
+         if (a1 == nullptr || a2 == nullptr) {
+            return 0;
          }
-         if (savings >= 0) {
-            // Avoid inserting same pack twice
-            if (P.find(Pack_t({ u2, u1 })) == P.end()) {
-               P.insert(Pack_t({ u1, u2 }));
+         int savings = 1;
+         std::vector<std::pair<std::string, std::string>> operands = { { a1->op1(), a2->op1() }, { a1->op2(), a2->op2() } };
+         for (const auto & x : operands) {
+            bool packed = false;
+            if (_defs.find(x.first) != _defs.end() && _defs.find(x.second) != _defs.end()) {
+               packed = _paired.find(std::make_pair(_defs[x.first][0], _defs[x.second][0])) != _paired.end();
             }
+            savings += packed ? 1 : -1;
          }
-         return P;
+         return savings;
       }
-      PackSet_t extend_packlist(std::shared_ptr<BasicBlock> B, PackSet_t P) {
-         PackSet_t Pprev, Pnext;
-         do {
-            Pprev = P;
-            Pnext = P;
-            for (const auto & p : P) {
-               Pnext = follow_use_defs(B, Pnext, p);
-               Pnext = follow_def_uses(B, Pnext, p);
-            }
-            P = Pnext;
-         } while (P != Pprev);
-         return P;
-      }
-      PackSet_t combine_packs(PackSet_t P) {
-         PackSet_t Pprev, Pnext;
-         do {
-            Pprev = P;
-            Pnext = P;
-            for (const auto & p1 : P) {
-               for (const auto & p2 : P) {
-                  std::shared_ptr<IRStatement> sn = p1[p1.size()-1];
-                  std::shared_ptr<IRStatement> s1 = p2[0];
-                  if (sn == s1) {
-                     Pack_t newPack;
-                     newPack.reserve(p1.size()+p2.size()-1);
-                     newPack.insert(newPack.end(), p1.begin(), p1.end());
-                     newPack.insert(newPack.end(), p2.begin()+1, p2.end());
-                     Pnext.erase(p1);
-                     Pnext.erase(p2);
-                     Pnext.insert(newPack);
-                     return combine_packs(Pnext);
+      void follow_def_uses(Pack_t p) {
+         // Get s1 and s2 lhs
+         std::vector<std::string> & x1 = _lhs[p[0]];
+         std::vector<std::string> & x2 = _lhs[p[1]];
+         if (x1.size() != 1 || x2.size() != 1 || _uses.find(x1[0]) == _uses.end() || _uses.find(x2[0]) == _uses.end()) {
+            return;
+         }
+         // The pair of uses that saves the most, the last one on a tie.
+         // Whether it pays off at all is decided once the packs are done.
+         int savings = 0;
+         bool found = false;
+         unsigned long u1 = 0;
+         unsigned long u2 = 0;
+         for (const auto & t1 : _uses[x1[0]]) {
+            for (const auto & t2 : _uses[x2[0]]) {
+               if (stmts_can_pack(t1, t2)) {
+                  int est = estimate_savings(t1, t2);
+                  if (!found || est >= savings) {
+                     savings = est;
+                     u1 = t1;
+                     u2 = t2;
+                     found = true;
                   }
                }
             }
-            P = Pnext;
-         } while(P != Pprev);
-         return P;
+         }
+         if (found) {
+            add_pack(u1, u2);
+         }
       }
-      bool deps_scheduled(std::shared_ptr<PrimitiveStatement> s, std::shared_ptr<BasicBlock> B) {
-         if (dynamic_cast<PhiPrimitive*>(s.get()) != nullptr) {
-            // Phi primitives may cause cycles, but should always be at top of block - do not reschedule
-            return true;
+      // Grows the pairs from the one at offset from on
+      void extend_packlist(unsigned long from) {
+         // A run of refs whose slots go against program order is a permuted
+         // pack. What it would pair up disagrees with the in-order packs, so
+         // those get followed first and the permuted ones only fill in.
+         std::set<std::pair<bool, std::string>> permuted;
+         for (unsigned long k=from; k<_pairs.size(); k++) {
+            const Pack_t & p = _pairs[k];
+            bool getelt;
+            std::string arr;
+            long slot;
+            if (p[1] < p[0] && ref(p[0], getelt, arr, slot)) {
+               permuted.insert(std::make_pair(getelt, arr));
+            }
          }
-         // Check that all deps of s (RHS) are set in B
-         std::vector<std::string> deps = s->RHS();
-         for (const auto & dep : deps) {
-            if (isRegister(dep)) {
-               // Check if already scheduled
-               if (_scheduled.find(dep) != _scheduled.end()) {
-                  continue;
+         for (bool in_order : { true, false }) {
+            std::deque<Pack_t> worklist;
+            for (unsigned long k=from; k<_pairs.size(); k++) {
+               const Pack_t & p = _pairs[k];
+               bool getelt;
+               std::string arr;
+               long slot;
+               if (!in_order || !ref(p[0], getelt, arr, slot) || permuted.find(std::make_pair(getelt, arr)) == permuted.end()) {
+                  worklist.push_back(p);
                }
-               // Check that dep is a method parameter, if so it does not have a set line
-               std::vector<std::string> params = _new_method->first_block()->params();
-               bool is_scheduled = false;
-               for (const auto & p : params) {
-                  if (p == dep) {
-                     _scheduled.insert(dep);
-                     is_scheduled = true;
-                     break;
-                  }
-               }
-               if (is_scheduled) {
-                  continue;
+            }
+            // A pair is looked at again as long as it keeps finding new ones
+            while (!worklist.empty()) {
+               Pack_t p = worklist.front();
+               worklist.pop_front();
+               unsigned long found = _pairs.size();
+               follow_use_defs(p);
+               follow_def_uses(p);
+               if (_pairs.size() != found) {
+                  worklist.insert(worklist.end(), _pairs.begin() + found, _pairs.end());
+                  worklist.push_back(p);
                }
-               return false;
             }
          }
-         return true;
       }
-      Pack_t first(std::shared_ptr<BasicBlock> B, PackSet_t P) {
-         std::map<std::shared_ptr<PrimitiveStatement>, unsigned long> stmt_to_offset;
-         unsigned long i = 0;
-         for (const auto & s : B->primitives()) {
-            stmt_to_offset[s] = i++;
+      unsigned long find(std::vector<unsigned long> & parent, unsigned long i) {
+         while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
          }
-         unsigned long earliest = stmt_to_offset.size();
-         Pack_t earliest_pack;
-         for (const auto & p : P) {
-            for (const auto & s : p) {
-               if (stmt_to_offset.find(s) != stmt_to_offset.end()) {
-                  if (stmt_to_offset[s] < earliest) {
-                     earliest = stmt_to_offset[s];
-                     earliest_pack = p;
+         return i;
+      }
+      // Pairs sharing a statement are chained into one pack. A statement
+      // is first and second of at most one pair each, so every set of
+      // chained pairs is a path, or a cycle we cut at its earliest statement.
+      PackSet_t combine_packs() {
+         const unsigned long none = _stmts.size();
+         std::vector<unsigned long> parent(_stmts.size());
+         std::vector<unsigned long> next(_stmts.size(), none);
+         std::vector<bool> has_prev(_stmts.size(), false);
+         for (unsigned long i=0; i<parent.size(); i++) {
+            parent[i] = i;
+         }
+         for (const auto & p : _pairs) {
+            next[p[0]] = p[1];
+            has_prev[p[1]] = true;
+            parent[find(parent, p[0])] = find(parent, p[1]);
+         }
+         std::set<unsigned long> headed;
+         std::vector<unsigned long> heads;
+         for (unsigned long i=0; i<_stmts.size(); i++) {
+            if (next[i] != none && !has_prev[i]) {
+               headed.insert(find(parent, i));
+               heads.push_back(i);
+            }
+         }
+         for (unsigned long i=0; i<_stmts.size(); i++) {
+            if (next[i] != none && headed.insert(find(parent, i)).second) {
+               heads.push_back(i);
+            }
+         }
+         PackSet_t P;
+         for (const auto & h : heads) {
+            Pack_t pack = { h };
+            for (unsigned long i=next[h]; i != none && i != h; i=next[i]) {
+               pack.push_back(i);
+            }
+            P.push_back(pack);
+         }
+         return P;
+      }
+      // Vector holding args, one that already has exactly these lanes, a
+      // shuffle of one that has them all, or else loaded
+      std::string load_vector(std::vector<std::string> args, std::shared_ptr<BasicBlock> B2) {
+         if (_vectors.find(args) != _vectors.end()) {
+            return _vectors[args];
+         }
+         std::string VEC = std::string("%") + std::string(VECTOR) + std::to_string(_vector_counter++);
+         std::vector<unsigned long> indices;
+         if (_lane_of.find(args[0]) != _lane_of.end()) {
+            for (const auto & lanes : _lane_of[args[0]]) {
+               if (shuffles(args, lanes)) {
+                  for (const auto & a : args) {
+                     indices.push_back(std::find(lanes.begin(), lanes.end(), a) - lanes.begin());
                   }
+                  B2->appendPrimitive(std::make_shared<ShuffleVectorPrimitive>(VEC, _vectors[lanes], indices));
+                  break;
                }
             }
          }
-         return earliest_pack;
+         if (indices.empty()) {
+            B2->appendPrimitive(std::make_shared<LoadVectorPrimitive>(VEC, args));
+         }
+         track(VEC, args);
+         return VEC;
       }
       void schedule_vector(std::vector<std::string> v1_args, std::vector<std::string> v2_args, std::vector<std::string> lhs_args, char op, std::shared_ptr<BasicBlock> B2) {
-         std::string VEC1 = std::string("%") + std::string(VECTOR) + std::to_string(_vector_counter++);
-         B2->appendPrimitive(std::make_shared<LoadVectorPrimitive>(VEC1, v1_args));
-         std::string VEC2 = std::string("%") + std::string(VECTOR) + std::to_string(_vector_counter++);
-         B2->appendPrimitive(std::make_shared<LoadVectorPrimitive>(VEC2, v2_args));
+         std::string VEC1 = load_vector(v1_args, B2);
+         std::string VEC2 = load_vector(v2_args, B2);
          std::string DEST_VEC = std::string("%") + std::string(VECTOR) + std::to_string(_vector_counter++);
          if (op == '+') {
             B2->appendPrimitive(std::make_shared<AddVectorPrimitive>(DEST_VEC, VEC1, VEC2));
@@ -321,108 +842,302 @@ class VectorOptimizer : public IdentityOptimizer
          } else if (op == '/') {
             B2->appendPrimitive(std::make_shared<DivideVectorPrimitive>(DEST_VEC, VEC1, VEC2));
          }
+         for (const auto & l : lhs_args) {
+            invalidate(l);
+         }
          B2->appendPrimitive(std::make_shared<StoreVectorPrimitive>(lhs_args, DEST_VEC));
+         // Padding lanes don't hold anything a pack could ask for
+         if (std::find(lhs_args.begin(), lhs_args.end(), "%UNUSED") == lhs_args.end()) {
+            track(DEST_VEC, lhs_args);
+         }
       }
-      std::shared_ptr<BasicBlock> schedule(std::shared_ptr<BasicBlock> B1, std::shared_ptr<BasicBlock> B2, PackSet_t P) {
-         std::vector<std::shared_ptr<PrimitiveStatement>> s = B1->primitives();
-         for (unsigned long i=0; i < s.size(); i++) {
-            bool p_exists = false;
-            Pack_t p;
-            for (const auto & p_cand : P) {
-               if (std::find(p_cand.begin(), p_cand.end(), s[i]) != p_cand.end()) {
-                  p = p_cand;
-                  p_exists = true;
-                  break;
+      // Vector holding these lanes in any order, padding them with op's
+      // identity if one has to be loaded
+      std::string reduce_vector(std::vector<std::string> args, char op, std::shared_ptr<BasicBlock> B2) {
+         if (_lane_of.find(args[0]) != _lane_of.end()) {
+            for (const auto & lanes : _lane_of[args[0]]) {
+               if (sorted(lanes) == sorted(args)) {
+                  return _vectors[lanes];
+               }
+            }
+         }
+         std::string identity = op == '*' ? "1" : op == '&' ? "18446744073709551615" : "0";
+         unsigned long width = vector_width(args.size());
+         while (args.size() < width) {
+            args.push_back(identity);
+         }
+         return load_vector(args, B2);
+      }
+      // A vecreduce per vector of leaves, then whatever is left in scalars.
+      // The tree's own registers are dead by now and hold the partial results.
+      void schedule_reduction(const Reduction & red, std::shared_ptr<BasicBlock> B2) {
+         std::vector<std::vector<std::string>> c = chunks(red);
+         bool leftover = red.leaves.size() % _width == 1;
+         unsigned long total = 2 * c.size() - 1 + (leftover ? 1 : 0);
+         unsigned long next = 0;
+         auto result = [&] () {
+            std::string lhs = _lhs[next + 1 == total ? red.stmts.back() : red.stmts[next]][0];
+            next++;
+            invalidate(lhs);
+            return lhs;
+         };
+         std::vector<std::string> partials;
+         for (const auto & lanes : c) {
+            std::string VEC = reduce_vector(lanes, red.op, B2);
+            partials.push_back(result());
+            B2->appendPrimitive(std::make_shared<ReduceVectorPrimitive>(partials.back(), red.op, VEC));
+         }
+         if (leftover) {
+            partials.push_back(red.leaves.back());
+         }
+         std::string acc = partials[0];
+         for (unsigned long k=1; k<partials.size(); k++) {
+            std::string lhs = result();
+            B2->appendPrimitive(std::make_shared<ArithmeticPrimitive>(lhs, acc, red.op, partials[k]));
+            acc = lhs;
+         }
+      }
+      // Lanes some vector operation of the block takes or gives, as they
+      // are and sorted
+      std::set<std::vector<std::string>> _wanted;
+      // Statements k up to k+width of a memory pack are consecutive slots
+      // of one object in some order, and these are their lanes by slot
+      bool memory_lanes(const Pack_t & p, unsigned long k, unsigned long width, std::vector<std::string> & lanes, std::string & arr, long & first) {
+         if (k + width > p.size()) {
+            return false;
+         }
+         std::map<long, std::string> by_slot;
+         bool kind = false;
+         for (unsigned long j=k; j<k+width; j++) {
+            bool getelt;
+            std::string base;
+            long slot;
+            if (!ref(p[j], getelt, base, slot) || (j > k && (getelt != kind || base != arr))) {
+               return false;
+            }
+            kind = getelt;
+            arr = base;
+            SetEltPrimitive* se = dynamic_cast<SetEltPrimitive*>(_stmts[p[j]].get());
+            by_slot[slot] = se == nullptr ? _lhs[p[j]][0] : se->val();
+         }
+         if (by_slot.size() != width || by_slot.rbegin()->first - by_slot.begin()->first != (long) width - 1) {
+            return false;
+         }
+         first = by_slot.begin()->first;
+         lanes.clear();
+         for (const auto & kv : by_slot) {
+            lanes.push_back(kv.second);
+         }
+         return true;
+      }
+      bool wanted(const Pack_t & p, unsigned long k, unsigned long width) {
+         std::vector<std::string> lanes;
+         std::string arr;
+         long first;
+         return memory_lanes(p, k, width, lanes, arr, first) && _wanted.find(sorted(lanes)) != _wanted.end();
+      }
+      // A memory pack goes out a whole vector at a time wherever its members
+      // are consecutive slots of one object, in any order, and as scalars
+      // where they aren't. Vectors are never padded here, the extra lanes
+      // could be past the end. The vector has the lanes in slot order, a
+      // pack wanting them in another order shuffles them. Where a run of
+      // slots is cut follows the lanes other vectors want.
+      void schedule_memory(const Pack_t & p, std::shared_ptr<BasicBlock> B2) {
+         std::vector<std::string> lanes;
+         std::string arr;
+         long first;
+         unsigned long k = 0;
+         while (k < p.size()) {
+            // The widest vector starting here someone wants, or if one
+            // starts a bit later, the widest one that stops before it
+            unsigned long limit = _width;
+            unsigned long width = 0;
+            for (unsigned long w=_width; w>=2 && width == 0; w/=2) {
+               if (wanted(p, k, w)) {
+                  width = w;
                }
             }
-            if (p_exists) {
-               bool all_deps_scheduled = true;
-               for (const auto & s2 : p) {
-                  if (!deps_scheduled(s2, B2)) {
-                     all_deps_scheduled = false;
+            for (unsigned long d=1; d<limit && width == 0; d++) {
+               for (unsigned long w=2; w<=_width; w*=2) {
+                  if (wanted(p, k + d, w)) {
+                     limit = d;
                      break;
                   }
                }
-               if (all_deps_scheduled) {
-                  ArithmeticPrimitive* atest = dynamic_cast<ArithmeticPrimitive*>(p[0].get());
-                  std::vector<char> ops = { '+', '-', '*', '/' };
-                  if (atest != nullptr && std::find(ops.begin(), ops.end(), atest->op()) != ops.end()) {
-                     // Replace w/ vector equivalent
-                     size_t count = 0;
-                     std::vector<std::string> v1_args;
-                     std::vector<std::string> v2_args;
-                     std::vector<std::string> lhs_args;
-                     char op = atest->op();
-                     for (const auto & s2 : p) {
-                        ArithmeticPrimitive* a = dynamic_cast<ArithmeticPrimitive*>(s2.get());
-                        v1_args.push_back(a->op1());
-                        v2_args.push_back(a->op2());
-                        lhs_args.push_back(a->lhs());
-                        B1->removePrimitive(s2);
-                        std::vector<std::string> s2_lhs = s2->LHS();
-                        for (const auto & lhs : s2_lhs) {
-                           _scheduled.insert(lhs);
-                        }
-                        count += 1;
-                        count %= UNROLL_SIZE;
-                        if (count == 0) {
-                           // Flush vectors
-                           schedule_vector(v1_args, v2_args, lhs_args, op, B2);
-                           v1_args.clear();
-                           v2_args.clear();
-                           lhs_args.clear();
-                        }
-                     }
-                     // Flush final vectors
-                     if (lhs_args.size() > 0) {
-                        while (lhs_args.size() < UNROLL_SIZE) {
-                           // Pad with zero at end
-                           lhs_args.push_back("%UNUSED");
-                           v1_args.push_back(std::to_string(0));
-                           v2_args.push_back(std::to_string(0));
-                        }
-                        // Final vector
-                        schedule_vector(v1_args, v2_args, lhs_args, op, B2);
-                     }
-                  } else {
-                     for (const auto & s2 : p) {
-                        B2->appendPrimitive(s2);
-                        std::vector<std::string> s2_lhs = s2->LHS();
-                        for (const auto & lhs : s2_lhs) {
-                           _scheduled.insert(lhs);
-                        }
-                        B1->removePrimitive(s2);
-                     }
-                  }
-                  return schedule(B1, B2, P);
+            }
+            for (unsigned long w=_width; w>2 && width == 0; w/=2) {
+               // Two lanes nobody wants take as many instructions as scalars
+               if (w <= limit && memory_lanes(p, k, w, lanes, arr, first)) {
+                  width = w;
                }
-            } else if (deps_scheduled(s[i], B2)) {
-               B2->appendPrimitive(s[i]);
-               std::vector<std::string> si_lhs = s[i]->LHS();
-               for (const auto & lhs : si_lhs) {
-                  _scheduled.insert(lhs);
+            }
+            if (width == 0) {
+               for (const auto & l : _lhs[p[k]]) {
+                  invalidate(l);
                }
-               B1->removePrimitive(s[i]);
-               return schedule(B1, B2, P);
+               B2->appendPrimitive(_stmts[p[k]]);
+               k++;
+               continue;
             }
+            memory_lanes(p, k, width, lanes, arr, first);
+            if (dynamic_cast<GetEltPrimitive*>(_stmts[p[k]].get()) != nullptr) {
+               std::string VEC = std::string("%") + std::string(VECTOR) + std::to_string(_vector_counter++);
+               B2->appendPrimitive(std::make_shared<GetEltVectorPrimitive>(VEC, arr, std::to_string(first), width));
+               for (const auto & l : lanes) {
+                  invalidate(l);
+               }
+               B2->appendPrimitive(std::make_shared<StoreVectorPrimitive>(lanes, VEC));
+               track(VEC, lanes);
+            } else {
+               B2->appendPrimitive(std::make_shared<SetEltVectorPrimitive>(arr, std::to_string(first), load_vector(lanes, B2)));
+            }
+            k += width;
+         }
+      }
+      // List scheduling over the block's dependence graph, earliest
+      // statement first. A pack is scheduled once every member is ready,
+      // if one never gets ready (it depends on another member through
+      // something else) the earliest blocked pack is given up on.
+      void schedule(std::shared_ptr<BasicBlock> B2, PackSet_t P) {
+         const std::vector<std::shared_ptr<PrimitiveStatement>> & s = _stmts;
+         DependenceGraph deps(s, _aa);
+         _vectors.clear();
+         _lane_of.clear();
+         // Every statement goes out in a unit, its pack or by itself
+         std::vector<Pack_t> units;
+         std::vector<unsigned long> unit_of(s.size());
+         std::vector<bool> packed(s.size(), false);
+         for (const auto & p : P) {
+            for (const auto & i : p) {
+               unit_of[i] = units.size();
+               packed[i] = true;
+            }
+            units.push_back(p);
          }
-         if (s.size() != 0) {
-            Pack_t p = first(B1, P);
-            P.erase(p);
-            return schedule(B1, B2, P);
+         for (unsigned long i=0; i < s.size(); i++) {
+            if (!packed[i]) {
+               unit_of[i] = units.size();
+               units.push_back({ i });
+            }
+         }
+         // Reductions by their root
+         std::map<unsigned long, unsigned long> reduction_of;
+         _wanted.clear();
+         for (unsigned long r=0; r<_reductions.size(); r++) {
+            reduction_of[_reductions[r].stmts.back()] = r;
+            for (const auto & c : chunks(_reductions[r])) {
+               _wanted.insert(sorted(c));
+            }
+         }
+         for (const auto & p : P) {
+            if (isVectorOp(p[0])) {
+               for (int which=0; which<3; which++) {
+                  _wanted.insert(sorted(lanes(p, which)));
+               }
+            }
+         }
+         std::vector<bool> scheduled(s.size(), false);
+         // Unscheduled dependences from outside each unit. Lanes of a
+         // vector can't depend on each other, so one inside an arithmetic
+         // pack means it never gets ready and is given up on.
+         std::vector<unsigned long> waiting(units.size(), 0);
+         auto wait = [&] (unsigned long u) {
+            waiting[u] = 0;
+            bool lanes = units[u].size() > 1 && isVectorOp(units[u][0]) && reduction_of.find(units[u].back()) == reduction_of.end();
+            for (const auto & i : units[u]) {
+               for (const auto & d : deps.preds(i)) {
+                  if (!scheduled[d] && (lanes || unit_of[d] != u)) {
+                     waiting[u]++;
+                  }
+               }
+            }
+         };
+         // Ready units by their earliest statement
+         typedef std::pair<unsigned long, unsigned long> Ready;
+         std::priority_queue<Ready, std::vector<Ready>, std::greater<Ready>> ready;
+         auto first = [&] (unsigned long u) {
+            return *std::min_element(units[u].begin(), units[u].end());
+         };
+         for (unsigned long u=0; u < units.size(); u++) {
+            wait(u);
+            if (waiting[u] == 0) {
+               ready.push(std::make_pair(first(u), u));
+            }
+         }
+         unsigned long remaining = s.size();
+         unsigned long earliest = 0;
+         while (remaining > 0) {
+            if (ready.empty()) {
+               // Give up on the pack of the earliest statement left
+               while (scheduled[earliest]) {
+                  earliest++;
+               }
+               Pack_t p = units[unit_of[earliest]];
+               for (const auto & i : p) {
+                  unit_of[i] = units.size();
+                  units.push_back({ i });
+                  waiting.push_back(0);
+               }
+               for (const auto & i : p) {
+                  wait(unit_of[i]);
+                  if (waiting[unit_of[i]] == 0) {
+                     ready.push(std::make_pair(i, unit_of[i]));
+                  }
+               }
+               continue;
+            }
+            unsigned long u = ready.top().second;
+            ready.pop();
+            const Pack_t p = units[u];
+            ArithmeticPrimitive* atest = dynamic_cast<ArithmeticPrimitive*>(s[p[0]].get());
+            if (p.size() > 1 && reduction_of.find(p.back()) != reduction_of.end()) {
+               schedule_reduction(_reductions[reduction_of[p.back()]], B2);
+            } else if (p.size() > 1 && isVectorOp(p[0])) {
+               // Replace w/ vector equivalent, packs are a vector each by now
+               schedule_vector(lanes(p, 0), lanes(p, 1), lanes(p, 2), atest->op(), B2);
+            } else if (p.size() > 1 && atest == nullptr) {
+               schedule_memory(p, B2);
+            } else {
+               for (const auto & i : p) {
+                  for (const auto & l : _lhs[i]) {
+                     invalidate(l);
+                  }
+                  B2->appendPrimitive(s[i]);
+               }
+            }
+            for (const auto & i : p) {
+               scheduled[i] = true;
+               remaining--;
+            }
+            for (const auto & i : p) {
+               for (const auto & d : deps.succs(i)) {
+                  unsigned long v = unit_of[d];
+                  if (v != u && --waiting[v] == 0) {
+                     ready.push(std::make_pair(first(v), v));
+                  }
+               }
+            }
          }
-         return B2;
       }
    public:
+      VectorOptimizer(unsigned long width = UNROLL_SIZE, Profile profile = Profile()) : _width(width), _profile(profile) {}
       void optimizeBlock(BasicBlock& node) {
          std::string label = node.label();
+         if (_profile.cold(_method, label)) {
+            IdentityOptimizer::optimizeBlock(node);
+            return;
+         }
          if (!_label_to_block.count(label)) {
             _label_to_block[label] = std::make_shared<BasicBlock>(label, node.params());
          }
          _new_block = _label_to_block[label];
          // Don't copy primitives over just yet
-         // Call SLP extract to modify _new_block
-         SLP_extract(std::make_shared<BasicBlock>(node));
+         // Call SLP extract to schedule them, then keep what is read
+         std::shared_ptr<BasicBlock> scheduled = std::make_shared<BasicBlock>(label);
+         SLP_extract(std::make_shared<BasicBlock>(node), scheduled);
+         for (const auto & p : live_vectors(scheduled->primitives(), node.control())) {
+            _new_block->appendPrimitive(p);
+         }
          // Optimize control
          node.control()->accept(*this);
       }
@@ -434,7 +1149,31 @@ class VectorOptimizer : public IdentityOptimizer
 
       void visit(MethodCFG& node) {
          _vector_counter = 0;
-         _scheduled.clear();
+         _method = node.first_block()->label();
+         std::shared_ptr<MethodCFG> method = std::make_shared<MethodCFG>(node);
+         _aa.setMethod(method);
+         _phi_used.clear();
+         _users.clear();
+         DominatorSolver ds;
+         for (const auto & kv : ds.solveBlockmap(method)) {
+            for (const auto & p : kv.second->primitives()) {
+               std::vector<std::string> rhs = p->RHS();
+               for (const auto & r : rhs) {
+                  if (dynamic_cast<PhiPrimitive*>(p.get()) != nullptr) {
+                     _phi_used.insert(r);
+                  } else {
+                     _users[r].insert(kv.first);
+                  }
+               }
+            }
+            for (const auto & r : kv.second->control()->RHS()) {
+               _users[r].insert(kv.first);
+            }
+         }
+         IdentityOptimizer::visit(node);
+      }
+      void visit(ProgramCFG& node) {
+         _aa.analyze(node);
          IdentityOptimizer::visit(node);
       }
 };
@@ -1,16 +1,35 @@
+#include <fstream>
 #include <iostream>
 #include "ArithmeticOptimizer.h"
 #include "TypeChecker.h"
 #include "BetterSSAOptimizer.h"
+#include "DeadStoreOptimizer.h"
+#include "EGraphOptimizer.h"
+#include "FieldLayout.h"
+#include "InstrumentOptimizer.h"
 #include "JumpOptimizer.h"
+#include "LayoutOptimizer.h"
+#include "LoadEliminationOptimizer.h"
+#include "OutOfSSAOptimizer.h"
+#include "ReassociationOptimizer.h"
+#include "RegisterAllocator.h"
 #include "SSAOptimizer.h"
+#include "SuperblockOptimizer.h"
+#include "TailCallOptimizer.h"
 #include "ValueNumberOptimizer.h"
 #include "VectorOptimizer.h"
 #include "CFGBuilder.h"
 #include "Parser.h"
 
 int main(int argc, char ** argv) {
-   bool printAST = false, noSSA = false, noopt = false, simpleSSA = false, noVN = false, vectorize = false;
+   bool printAST = false, noSSA = false, noopt = false, simpleSSA = false, noVN = false, vectorize = false, outSSA = false, tailcalls = false, sharedfail = false, noreassoc = false, O3 = false;
+   unsigned long registers = 0;
+   unsigned long vecwidth = UNROLL_SIZE;
+   Profile profile;
+   RuleTable rules;
+   std::string rulesfile;
+   std::string instrument;
+   std::string fieldlayout = "alpha";
    for (int i=0; i<argc; i++) {
       std::string arg = argv[i];
       if (arg == "-printAST") {
@@ -21,23 +40,84 @@ int main(int argc, char ** argv) {
          noVN = true;
       } else if (arg == "-noopt") {
          noopt = true;
+      } else if (arg == "-O3") {
+         O3 = true;
       } else if (arg == "-simpleSSA") {
          simpleSSA = true;
       } else if (arg == "-noVN") {
          noVN = true;
+      } else if (arg == "-noreassoc") {
+         noreassoc = true;
       } else if (arg == "-vectorize") {
          vectorize = true;
+      } else if (arg == "-tailcalls") {
+         tailcalls = true;
+      } else if (arg == "-sharedfail") {
+         sharedfail = true;
+      } else if (arg == "-outSSA") {
+         outSSA = true;
+      } else if (arg.rfind("-regalloc=", 0) == 0) {
+         registers = std::stoul(arg.substr(std::string("-regalloc=").length()));
+         // Allocation works on code out of SSA form
+         outSSA = true;
+      } else if (arg.rfind("-vecwidth=", 0) == 0) {
+         vecwidth = std::stoul(arg.substr(std::string("-vecwidth=").length()));
+         if (vecwidth < 2 || (vecwidth & (vecwidth - 1)) != 0) {
+            std::cerr << "Vector width must be a power of two, at least 2" << std::endl;
+            return 1;
+         }
+      } else if (arg.rfind("-fieldlayout=", 0) == 0) {
+         fieldlayout = arg.substr(std::string("-fieldlayout=").length());
+         if (fieldlayout != "alpha" && fieldlayout != "decl" && fieldlayout != "affinity" && fieldlayout != "profile") {
+            std::cerr << "Field layout must be alpha, decl, affinity or profile" << std::endl;
+            return 1;
+         }
+      } else if (arg.rfind("-instrument=", 0) == 0) {
+         instrument = arg.substr(std::string("-instrument=").length());
+      } else if (arg.rfind("-rules=", 0) == 0) {
+         std::string file = arg.substr(std::string("-rules=").length());
+         std::ifstream in(file);
+         if (!in || !rules.load(in)) {
+            std::cerr << "Could not read rules " << file << std::endl;
+            return 1;
+         }
+         rulesfile = file;
+      } else if (arg.rfind("-profile-use=", 0) == 0) {
+         std::string file = arg.substr(std::string("-profile-use=").length());
+         std::ifstream in(file);
+         if (!in || !profile.load(in)) {
+            std::cerr << "Could not read profile " << file << std::endl;
+            return 1;
+         }
       }
    }
+   if (fieldlayout == "profile" && profile.empty()) {
+      std::cerr << "Laying out fields by profile needs -profile-use" << std::endl;
+      return 1;
+   }
+   if (noSSA && rulesfile != "") {
+      std::cerr << "Ignoring rules " << rulesfile << ", they need SSA form" << std::endl;
+   }
    ProgramParser parser;
    TypeChecker checker;
-   CFGBuilder builder;
+   FieldLayout field_layout(fieldlayout == "profile" ? profile : Profile());
    BetterSSAOptimizer better_ssa_optimizer;
    SSAOptimizer ssa_optimizer;
-   ArithmeticOptimizer peephole_optimizer;
+   // The rules look through definitions, which only stay put in SSA
+   ArithmeticOptimizer peephole_optimizer(noSSA ? RuleTable() : rules);
+   ReassociationOptimizer reassociation_optimizer;
    ValueNumberOptimizer vn_optimizer;
+   LoadEliminationOptimizer load_optimizer;
+   DeadStoreOptimizer dead_store_optimizer;
+   TailCallOptimizer tail_call_optimizer;
    JumpOptimizer j_optimizer;
-   VectorOptimizer vector_optimizer;
+   SuperblockOptimizer superblock_optimizer;
+   EGraphOptimizer egraph_optimizer(vectorize, vecwidth);
+   InstrumentOptimizer instrument_optimizer;
+   VectorOptimizer vector_optimizer(vecwidth, profile);
+   OutOfSSAOptimizer out_of_ssa_optimizer;
+   RegisterAllocator register_allocator(registers);
+   LayoutOptimizer layout_optimizer(profile);
    try {
       std::shared_ptr<ProgramDeclaration> progAST = parser.parse(std::cin);
       if (printAST) {
@@ -45,6 +125,15 @@ int main(int argc, char ** argv) {
          return 0;
       }
       checker.check(progAST);
+      std::map<std::string, std::vector<std::string>> field_order;
+      if (fieldlayout == "decl") {
+         field_order = field_layout.declared(progAST);
+      } else if (fieldlayout != "alpha") {
+         // Accesses are counted on a first build in the default layout
+         CFGBuilder first_builder(sharedfail);
+         field_order = field_layout.affinity(progAST, first_builder.build(progAST));
+      }
+      CFGBuilder builder(sharedfail, field_order);
       std::shared_ptr<ProgramCFG> progCFG = builder.build(progAST);
       if (!noSSA) {
          if (simpleSSA) {
@@ -57,14 +146,63 @@ int main(int argc, char ** argv) {
          progCFG = peephole_optimizer.optimize(progCFG);
       }
       if (!noVN) {
+         if (!noreassoc) {
+            // Canonical chains so VN finds more of them equal
+            progCFG = reassociation_optimizer.optimize(progCFG);
+         }
          progCFG = vn_optimizer.optimize(progCFG);
+         // Needs value numbered bases to match up memory accesses
+         progCFG = load_optimizer.optimize(progCFG);
+         // Forwarded loads may leave stores nobody reads
+         progCFG = dead_store_optimizer.optimize(progCFG);
+      }
+      if (tailcalls && !noSSA) {
+         // Loop headers merge parameters with phis, so SSA is needed
+         progCFG = tail_call_optimizer.optimize(progCFG);
+      }
+      // Value numbering and the checks leave lots of blocks that only jump
+      progCFG = j_optimizer.optimize(progCFG);
+      if (vectorize) {
+         // Null checks split the field accesses up, sink them past the checks
+         progCFG = superblock_optimizer.optimize(progCFG);
+      }
+      if (O3 && !noSSA) {
+         // After the superblocks, so whole kernels are in one block
+         progCFG = egraph_optimizer.optimize(progCFG);
+         // Cleans up the copies it leaves, vectorizing does it after
+         if (!vectorize && !noVN) {
+            progCFG = vn_optimizer.optimize(progCFG);
+         }
       }
       if (vectorize) {
-         progCFG = j_optimizer.optimize(progCFG);
          progCFG = vector_optimizer.optimize(progCFG);
-         // Second pass thru vn
-         progCFG = vn_optimizer.optimize(progCFG);
+         // Second pass thru vn, VN needs SSA
+         if (!noVN) {
+            progCFG = vn_optimizer.optimize(progCFG);
+         }
       }
+      if (instrument != "") {
+         // Count what is left once blocks stop being merged and removed,
+         // those are the labels -profile-use will see
+         progCFG = instrument_optimizer.optimize(progCFG);
+         std::ofstream sites(instrument);
+         for (const auto & s : instrument_optimizer.sites()) {
+            sites << s << std::endl;
+         }
+         if (!sites) {
+            std::cerr << "Could not write counter map " << instrument << std::endl;
+            return 1;
+         }
+      }
+      if (outSSA) {
+         // Must run last, later passes expect SSA form
+         progCFG = out_of_ssa_optimizer.optimize(progCFG);
+      }
+      if (registers > 0) {
+         progCFG = register_allocator.optimize(progCFG);
+      }
+      // Lay the likely paths out straight once nothing moves blocks around
+      progCFG = layout_optimizer.optimize(progCFG);
       std::cout << progCFG->toString() << std::endl;
       return 0;
    } catch (ParserException & p) {
@@ -74,6 +212,14 @@ int main(int argc, char ** argv) {
    } catch (TypeCheckerException & tc) {
       std::cerr << "Type checker error:" << std::endl;
       std::cerr << tc.info() << " : " << tc.line() << std::endl;
+   } catch (CFGBuilderException & cb) {
+      std::cerr << "CFG builder error:" << std::endl;
+      std::cerr << cb.info() << std::endl;
+      return 1;
+   } catch (OptimizerException & o) {
+      std::cerr << "Optimizer error:" << std::endl;
+      std::cerr << o.info() << std::endl;
+      return 1;
    }
    return 0;
 }
@@ -0,0 +1,253 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include "../src/RuleTable.h"
+
+// Searches every arithmetic sequence of up to N operations on x, y and
+// a few constants for ones a single operation (or none) computes, and
+// prints those as rules for -rules=FILE
+// usage: tools/superopt [N]
+// Sequences the peephole already simplifies one operation at a time are
+// skipped. Candidates are matched on a few random inputs first, then
+// checked on every input at 4 and 8 bits and lots of 64 bit ones, with
+// division by zero having to fail the same way. That is testing, not a
+// proof, so look over what it finds before using it.
+const char OPS[] = { '+', '-', '*', '/', '&', '|', '^' };
+const unsigned long LEAVES = 6;
+
+struct Operation
+{
+   char op;
+   unsigned long a;
+   unsigned long b;
+};
+
+typedef std::vector<Operation> Sequence;
+
+// Leaves are x, y, 0, 1, 2 and all ones, then the results in order
+unsigned long long leaf(unsigned long i, unsigned long long x, unsigned long long y, unsigned long long mask) {
+   const unsigned long long values[] = { x, y, 0, 1, 2, mask };
+   return values[i] & mask;
+}
+
+// False if it divides by zero
+bool evaluate(const Sequence & s, unsigned long long x, unsigned long long y, unsigned long long mask, unsigned long long & result) {
+   std::vector<unsigned long long> values;
+   for (unsigned long i=0; i<LEAVES; i++) {
+      values.push_back(leaf(i, x, y, mask));
+   }
+   for (const auto & o : s) {
+      unsigned long long v;
+      if (!RewriteRules::fold(o.op, values[o.a], values[o.b], v)) {
+         return false;
+      }
+      values.push_back(v & mask);
+   }
+   result = values.back();
+   return true;
+}
+
+std::string name(unsigned long i) {
+   const std::string names[] = { "%x", "%y", "0", "1", "2", std::to_string(~0ULL) };
+   return i < LEAVES ? names[i] : "%t" + std::to_string(i);
+}
+
+// An operation the peephole would leave alone, with commutative operands
+// only one way round
+bool canonical(const Operation & o) {
+   if (o.a >= 2 && o.a < LEAVES && o.b >= 2 && o.b < LEAVES) {
+      return false;
+   }
+   // Dividing by zero fails however it is done
+   if (o.op == '/' && o.b == 2) {
+      return false;
+   }
+   if (RewriteRules::commutative(o.op) && o.a > o.b) {
+      return false;
+   }
+   RewriteRules::Result r = RewriteRules::simplify(o.op, name(o.a), name(o.b));
+   return r.op == o.op && r.op1 == name(o.a) && r.op2 == name(o.b);
+}
+
+RuleTable::Pattern pattern(const Sequence & s, unsigned long i) {
+   if (i == 0 || i == 1) {
+      return { 'v', i == 0 ? "x" : "y", {} };
+   } else if (i < LEAVES) {
+      return { 'c', name(i), {} };
+   }
+   const Operation & o = s[i - LEAVES];
+   return { o.op, "", { pattern(s, o.a), pattern(s, o.b) } };
+}
+
+bool uses(const Sequence & s, unsigned long leaf) {
+   for (const auto & o : s) {
+      if (o.a == leaf || o.b == leaf) {
+         return true;
+      }
+   }
+   return false;
+}
+
+std::vector<std::pair<unsigned long long, unsigned long long>> samples(unsigned long count) {
+   std::mt19937_64 random(441);
+   const unsigned long long edges[] = { 0, 1, 2, 3, ~0ULL, ~0ULL - 1, 1ULL << 63 };
+   std::vector<std::pair<unsigned long long, unsigned long long>> inputs;
+   for (const auto & x : edges) {
+      for (const auto & y : edges) {
+         inputs.push_back(std::make_pair(x, y));
+      }
+   }
+   for (unsigned long i=0; i<count; i++) {
+      inputs.push_back(std::make_pair(random(), random()));
+   }
+   return inputs;
+}
+
+// Results on the inputs, with a flag for dividing by zero
+std::vector<unsigned long long> fingerprint(const Sequence & s, const std::vector<std::pair<unsigned long long, unsigned long long>> & inputs) {
+   std::vector<unsigned long long> fp;
+   for (const auto & in : inputs) {
+      unsigned long long v = 0;
+      bool ok = evaluate(s, in.first, in.second, ~0ULL, v);
+      fp.push_back(ok);
+      fp.push_back(v);
+   }
+   return fp;
+}
+
+bool same(const Sequence & s, const Sequence & t, unsigned long long x, unsigned long long y, unsigned long long mask) {
+   unsigned long long vs = 0, vt = 0;
+   bool ok = evaluate(s, x, y, mask, vs);
+   return ok == evaluate(t, x, y, mask, vt) && vs == vt;
+}
+
+bool verify(const Sequence & s, const Sequence & t, const std::vector<std::pair<unsigned long long, unsigned long long>> & inputs) {
+   for (const auto & bits : { 4, 8 }) {
+      unsigned long long mask = (1ULL << bits) - 1;
+      for (unsigned long long x=0; x<=mask; x++) {
+         for (unsigned long long y=0; y<=mask; y++) {
+            if (!same(s, t, x, y, mask)) {
+               return false;
+            }
+         }
+      }
+   }
+   for (const auto & in : inputs) {
+      if (!same(s, t, in.first, in.second, ~0ULL)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+// A leaf is kept as x & x, which the peephole never leaves behind
+Sequence copy(unsigned long leaf) {
+   return { { '&', leaf, leaf } };
+}
+
+bool isCopy(const Sequence & t) {
+   return t[0].op == '&' && t[0].a == t[0].b;
+}
+
+struct Search
+{
+   unsigned long length;
+   std::vector<std::pair<unsigned long long, unsigned long long>> quick;
+   std::vector<std::pair<unsigned long long, unsigned long long>> thorough;
+   // Fingerprints to the cheapest sequence with them, of at most one operation
+   std::map<std::vector<unsigned long long>, Sequence> candidates;
+   // What was found so far, a sequence it rewrites needs nothing new
+   RuleTable table;
+   unsigned long found = 0;
+
+   void candidate(const Sequence & s) {
+      std::vector<unsigned long long> fp = fingerprint(s, quick);
+      if (candidates.find(fp) == candidates.end()) {
+         candidates[fp] = s;
+      }
+   }
+
+   void target(const Sequence & s) {
+      // The peephole goes in order, so one rewriting an operation inside
+      // gets there first
+      RuleTable::Defs defs;
+      for (unsigned long i=0; i<s.size(); i++) {
+         RewriteRules::Result r;
+         if (table.apply(s[i].op, name(s[i].a), name(s[i].b), defs, r)) {
+            return;
+         }
+         defs[name(LEAVES + i)] = std::make_tuple(s[i].op, name(s[i].a), name(s[i].b));
+      }
+      auto c = candidates.find(fingerprint(s, quick));
+      if (c == candidates.end()) {
+         return;
+      }
+      const Sequence & t = c->second;
+      if ((!uses(s, 0) && uses(t, 0)) || (!uses(s, 1) && uses(t, 1)) || !verify(s, t, thorough)) {
+         return;
+      }
+      RuleTable::Pattern from = pattern(s, LEAVES + s.size() - 1);
+      RuleTable::Pattern to = isCopy(t) ? pattern(t, t[0].a) : pattern(t, LEAVES);
+      table.add(from, to);
+      std::cout << RuleTable::toString(from) << " => " << RuleTable::toString(to) << std::endl;
+      found++;
+   }
+
+   void extend(Sequence & s) {
+      if (s.size() == length) {
+         bool used = true;
+         for (unsigned long i=0; i+1<s.size(); i++) {
+            used = used && uses(Sequence(s.begin() + i + 1, s.end()), LEAVES + i);
+         }
+         if (used) {
+            target(s);
+         }
+      }
+      if (s.size() == length) {
+         return;
+      }
+      for (const auto & op : OPS) {
+         for (unsigned long a=0; a<LEAVES+s.size(); a++) {
+            for (unsigned long b=0; b<LEAVES+s.size(); b++) {
+               Operation o = { op, a, b };
+               if (!canonical(o)) {
+                  continue;
+               }
+               s.push_back(o);
+               extend(s);
+               s.pop_back();
+            }
+         }
+      }
+   }
+};
+
+int main(int argc, char ** argv) {
+   Search search;
+   search.quick = samples(16);
+   search.thorough = samples(10000);
+   // Leaves first, so they win over an operation doing the same
+   for (unsigned long i=0; i<LEAVES; i++) {
+      search.candidate(copy(i));
+   }
+   for (const auto & op : OPS) {
+      for (unsigned long a=0; a<LEAVES; a++) {
+         for (unsigned long b=0; b<LEAVES; b++) {
+            Operation o = { op, a, b };
+            if (canonical(o)) {
+               search.candidate({ o });
+            }
+         }
+      }
+   }
+   unsigned long longest = argc > 1 ? std::stoul(argv[1]) : 2;
+   std::cout << "# Found by tools/superopt " << longest << ", load with -rules=FILE" << std::endl;
+   // Shortest first, so longer sequences only get rules of their own
+   // for what the shorter ones miss
+   for (search.length=2; search.length<=longest; search.length++) {
+      Sequence s;
+      search.extend(s);
+   }
+   std::cerr << search.found << " rules" << std::endl;
+   return 0;
+}